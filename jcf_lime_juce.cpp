@@ -9,5 +9,11 @@
 #include "utils/pitch.cpp"
 #include "crypto/jcf_blowfish_extended.cpp"
 #include "crypto/jcf_secure_credentials.cpp"
+#include "utils/app_options_storage.cpp"
 #include "utils/app_options.cpp"
 
+#if JCF_BENCHMARKS
+#include "utils/app_options_benchmark.cpp"
+#include "utils/utility_benchmarks.cpp"
+#endif
+
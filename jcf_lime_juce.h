@@ -21,6 +21,14 @@
 
 #include <juce_core/juce_core.h>
 
+/** Config: JCF_BENCHMARKS
+    Builds jcf::AppOptionsBenchmark and jcf::UtilityBenchmarks, which measure the module's
+    performance and write the results as JSON.
+*/
+#ifndef JCF_BENCHMARKS
+#define JCF_BENCHMARKS 0
+#endif
+
 /**
  * Handy macro for cross-platform menu titles, e.g. Open In Explorer
  */
@@ -40,10 +48,18 @@ inline bool operator< (const Identifier& a, const Identifier& b)
 
 #include "ui/jcf_font_awesome.h"
 #include "utils/other_utils.h"
+#include "utils/parallel_for.h"
+#include "utils/keyed_shared_resource_cache.h"
 
 #include "utils/pitch.h"
 #include "crypto/jcf_blowfish_extended.h"
 #include "crypto/jcf_secure_credentials.h"
 #include "utils/lock_free_call_queue.h"
 #include "utils/multi_async_updater.h"
-#include "utils/app_options.h"
\ No newline at end of file
+#include "utils/coroutine_task.h"
+#include "utils/app_options.h"
+
+#if JCF_BENCHMARKS
+#include "utils/app_options_benchmark.h"
+#include "utils/utility_benchmarks.h"
+#endif
\ No newline at end of file
@@ -1,7 +1,194 @@
 
 #include "app_options.h"
+
+#if JUCE_LINUX
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
 namespace jcf
 {
+#if JUCE_LINUX
+/**
+ * Uses inotify to watch the directory holding the options files, as files saved atomically
+ * are replaced rather than written to.  Changes are passed to reloadIfChanged() on the
+ * message thread, which ignores our own saves.
+ */
+class AppOptions::FileWatcher : private Thread, private AsyncUpdater
+{
+public:
+    FileWatcher (AppOptions& owner_, const Array<File>& files) : Thread ("lc app options watcher"), owner (owner_)
+    {
+        for (auto& f : files)
+            fileNames.add (f.getFileName());
+
+        inotifyFd = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+
+        if (inotifyFd < 0)
+            return;
+
+        auto directory = files.getFirst().getParentDirectory().getFullPathName();
+
+        if (inotify_add_watch (inotifyFd, directory.toRawUTF8(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+            return;
+
+        startThread (Priority::low);
+    }
+
+    ~FileWatcher() override
+    {
+        stopThread (1000);
+        cancelPendingUpdate();
+
+        if (inotifyFd >= 0)
+            close (inotifyFd);
+    }
+
+private:
+    void run() override
+    {
+        alignas (inotify_event) char buffer[4096];
+
+        while (! threadShouldExit())
+        {
+            pollfd p{ inotifyFd, POLLIN, 0 };
+
+            // time out regularly to check threadShouldExit()
+            if (poll (&p, 1, 200) <= 0)
+                continue;
+
+            auto numRead = read (inotifyFd, buffer, sizeof (buffer));
+
+            for (ssize_t i = 0; i < numRead;)
+            {
+                auto* event = reinterpret_cast<const inotify_event*> (buffer + i);
+
+                if (event->len > 0 && fileNames.contains (String::fromUTF8 (event->name)))
+                    triggerAsyncUpdate();
+
+                i += (ssize_t) (sizeof (inotify_event) + event->len);
+            }
+        }
+    }
+
+    void handleAsyncUpdate() override { owner.reloadIfChanged(); }
+
+    AppOptions& owner;
+    StringArray fileNames;
+    int inotifyFd{ -1 };
+};
+#else
+class AppOptions::FileWatcher
+{
+};
+#endif
+
+/**
+ * Writes copies of the state handed over by the message thread.  Only the newest copy waiting
+ * is written, with the changes of any it replaced merged in, so a burst of saves while the
+ * disk is slow becomes one write.
+ */
+class AppOptions::Writer : private Thread
+{
+public:
+    explicit Writer (AppOptions& owner_) : Thread ("lc app options writer"), owner (owner_) { startThread (Priority::background); }
+
+    ~Writer() override
+    {
+        stopThread (-1);
+        writePending(); // anything queued as we were stopping
+    }
+
+    /** Queues a copy of the state.  No changes means everything should be saved. */
+    void enqueue (juce::ValueTree stateCopy, const std::set<Identifier>& changed)
+    {
+        {
+            ScopedLock sl (pendingLock);
+
+            pendingState = std::move (stateCopy);
+
+            if (changed.empty())
+                pendingFullSave = true;
+            else
+                pendingChanges.insert (changed.begin(), changed.end());
+        }
+
+        notify();
+    }
+
+    /** Writes whatever is queued on the calling thread. */
+    void writePending()
+    {
+        // held while writing so a flush on another thread can't be overtaken by an older copy
+        ScopedLock wl (writeLock);
+
+        ValueTree stateToWrite;
+        std::set<Identifier> changed;
+        bool fullSave;
+
+        {
+            ScopedLock sl (pendingLock);
+
+            if (! pendingState.isValid())
+                return;
+
+            stateToWrite = std::exchange (pendingState, {});
+            changed.swap (pendingChanges);
+            fullSave = std::exchange (pendingFullSave, false);
+        }
+
+        bool saved = false;
+
+        {
+            // saving and recording what was saved mustn't be split by a reload check
+            ScopedLock fl (owner.fileAccessLock);
+            InterProcessLock::ScopedLockType l (*owner.lock);
+
+            // set by the last load, which also holds fileAccessLock
+            if (owner.storage->isFromNewerVersion())
+            {
+                DBG ("jcf::AppOptions save skipped - the file is from a newer version");
+            }
+            else
+            {
+                auto result = fullSave ? owner.storage->save (owner.file, stateToWrite)
+                                       : owner.storage->saveChanges (owner.file, stateToWrite, changed);
+
+                // the storage has told us what it wrote, so there's nothing to read back here
+                if (result.failed())
+                    DBG ("jcf::AppOptions save failed: " + result.getErrorMessage());
+
+                saved = true;
+            }
+        }
+
+        // a check on the message thread that found us writing was put off until now
+        if (owner.reloadCheckDeferred.exchange (false))
+            owner.deferredReload.triggerAsyncUpdate();
+
+        if (saved)
+            owner.broadcastSave();
+    }
+
+private:
+    void run() override
+    {
+        while (! threadShouldExit())
+        {
+            wait (-1);
+            writePending();
+        }
+    }
+
+    AppOptions& owner;
+    CriticalSection writeLock;
+    CriticalSection pendingLock;
+    ValueTree pendingState;
+    std::set<Identifier> pendingChanges;
+    bool pendingFullSave{ false };
+};
+
 /**
  * Allows use to provide Value objects for use on the message thread without invaliding our threadsafety by
  * modifying the ValueTree on the message thread.
@@ -9,7 +196,7 @@ namespace jcf
 class AppOptions::ThreadSafeValueProxy : public Value::Listener, public AppOptions::Listener
 {
 public:
-    ThreadSafeValueProxy (AppOptions& appOptions_) : appOptions (appOptions_) { appOptions.addListener (this); }
+    ThreadSafeValueProxy (AppOptions& appOptions_) : appOptions (appOptions_) {}
 
     ~ThreadSafeValueProxy() override { appOptions.removeListener (this); }
 
@@ -17,42 +204,37 @@ public:
     {
         JUCE_ASSERT_MESSAGE_MANAGER_IS_LOCKED
 
-        for (auto& x : values)
-        {
-            if (x->id == id)
-                return x->value;
-        }
+        auto existing = recordsById.find (id);
+
+        if (existing != recordsById.end())
+            return existing->second->value;
 
         // we didn't find the value in our list
 
         auto obj = std::make_unique<Record> (id, Value (appOptions[id]));
         obj->value.addListener (this);
-        values.push_back (std::move (obj));
+        recordsBySource[&obj->value.getValueSource()] = obj.get();
+        appOptions.addListener (id, this);
 
-        return values.back()->value;
+        return recordsById.emplace (id, std::move (obj)).first->second->value;
     }
 
     void optionsChanged (const Identifier& identifierThatChanged) override
     {
-        for (auto& x : values)
-        {
-            if (x->id == identifierThatChanged)
-            {
-                x->value = appOptions[identifierThatChanged];
-                return;
-            }
-        }
+        auto record = recordsById.find (identifierThatChanged);
+
+        if (record != recordsById.end())
+            record->second->value = appOptions[identifierThatChanged];
     }
 
     void valueChanged (Value& value) override
     {
-        for (auto& x : values)
+        auto record = recordsBySource.find (&value.getValueSource());
+
+        if (record != recordsBySource.end())
         {
-            if (x->value.refersToSameSourceAs (value))
-            {
-                appOptions.setOption (x->id, value.getValue());
-                return;
-            }
+            appOptions.setOption (record->second->id, value.getValue());
+            return;
         }
 
         // we didn't find the value in our list
@@ -66,12 +248,26 @@ public:
         Value value;
     };
 
-    std::vector<std::unique_ptr<Record>> values;
+    /** Identifiers with the same name share a pooled string, so hash its address. */
+    struct IdentifierHash
+    {
+        size_t operator() (const Identifier& id) const noexcept { return std::hash<const void*>() (id.getCharPointer().getAddress()); }
+    };
+
+    std::unordered_map<Identifier, std::unique_ptr<Record>, IdentifierHash> recordsById;
+    std::unordered_map<const Value::ValueSource*, Record*> recordsBySource;
     AppOptions& appOptions;
 };
 
-jcf::AppOptions::AppOptions(const File& file, bool readOnly): file(file), readOnly (readOnly)
+jcf::AppOptions::AppOptions(const File& file, bool readOnly, std::unique_ptr<AppOptionsStorage> storage): file(file), readOnly (readOnly), storage (std::move (storage))
 {
+    if (this->storage == nullptr)
+        this->storage = std::make_unique<XmlAppOptionsStorage>();
+
+    storedFiles = this->storage->getFiles (file);
+    fileStates.resize ((size_t) storedFiles.size());
+    this->storage->onFileWritten = [this] (const File& f, const MemoryBlock& data, bool appended) { rememberFileWritten (f, data, appended); };
+
     // lock = new InterProcessLock(file.getFullPathName());
     lock = std::make_unique<InterProcessLock> (file.getFullPathName());
     state = ValueTree{ "state" };
@@ -79,21 +275,74 @@ jcf::AppOptions::AppOptions(const File& file, bool readOnly): file(file), readOn
     MessageManager::getInstance()->registerBroadcastListener (this);
     state.addListener (this);
 
+   #if JUCE_LINUX
+    fileWatcher = std::make_unique<FileWatcher> (*this, storedFiles);
+   #endif
+
+    writer = std::make_unique<Writer> (*this);
     valueProxy = std::make_unique<ThreadSafeValueProxy> (*this);
+
+    ScopedLock sl{ stateLock };
+    publishSnapshot();
 }
 
 jcf::AppOptions::~AppOptions()
 {
+    fileWatcher.reset();
+    cancelPendingUpdate();
     save();
+    writer.reset(); // finishes the save
+    deferredReload.cancelPendingUpdate();
 
     if (MessageManager::getInstanceWithoutCreating())
         MessageManager::getInstanceWithoutCreating()->deregisterBroadcastListener (this);
+
+    // there mustn't be any SnapshotReaders left by now
+    jassert (numOverflowReaders == 0);
+
+    for (auto& slot : readerSlots)
+        jassert (slot.epoch == 0);
+
+    for (auto& s : retiredSnapshots)
+        delete s.first;
+
+    delete currentSnapshot.load();
+}
+
+std::shared_ptr<jcf::AppOptions> jcf::AppOptions::getShared (const File& file, bool readOnly, std::unique_ptr<AppOptionsStorage> storage)
+{
+    struct Registry
+    {
+        CriticalSection lock;
+        std::map<String, std::weak_ptr<AppOptions>> instances;
+    };
+
+    // never deleted, the last reference may go during static destruction
+    static auto* registry = new Registry();
+
+    auto path = file.getLinkedTarget().getFullPathName();
+
+    ScopedLock sl{ registry->lock };
+
+    if (auto existing = registry->instances[path].lock())
+    {
+        jassert (existing->readOnly == readOnly); // shared with someone who opened it differently
+        return existing;
+    }
+
+    for (auto it = registry->instances.begin(); it != registry->instances.end();)
+        it = it->second.expired() ? registry->instances.erase (it) : std::next (it);
+
+    auto created = std::make_shared<AppOptions> (file, readOnly, std::move (storage));
+    registry->instances[path] = created;
+    return created;
 }
 
 void jcf::AppOptions::actionListenerCallback(const String& message)
 {
-    if (message == file.getFullPathName() && suppressCallback-- > 0)
-        load();
+    // our own saves come back here too, but reloadIfChanged() spots that nothing's changed
+    if (message == file.getFullPathName())
+        reloadIfChanged();
 }
 
 void jcf::AppOptions::setOption(const Identifier& identifier, var value)
@@ -123,14 +372,32 @@ void jcf::AppOptions::save()
 
     DBG("jcf::AppOptions::save()");
 
+    ScopedLock l0{ stateLock };
+    writer->enqueue (state.createCopy(), {});
+}
+
+void jcf::AppOptions::waitForPendingSaves()
+{
+    writer->writePending();
+}
+
+void jcf::AppOptions::saveChanges (const std::set<Identifier>& changed)
+{
+    // property changes are the only ones we can describe, anything else needs a full save
+    if (readOnly || changed.empty())
     {
-        InterProcessLock::ScopedLockType l (*lock);
-        ScopedLock l0{ stateLock };
-        jcf::saveValueTreeToXml (file, state);
+        save();
+        return;
     }
 
-    suppressCallback++;
+    DBG("jcf::AppOptions::saveChanges()");
+
+    ScopedLock l0{ stateLock };
+    writer->enqueue (state.createCopy(), changed);
+}
 
+void jcf::AppOptions::broadcastSave()
+{
     if (MessageManager::getInstanceWithoutCreating() != nullptr) // check to avoid a barely comprehensible crash on some shutdowns
         MessageManager::broadcastMessage(file.getFullPathName());
 }
@@ -140,9 +407,15 @@ void jcf::AppOptions::load()
 
 	DBG("jcf::AppOptions::load()");
 
+    ScopedLock fl{ fileAccessLock };
     InterProcessLock::ScopedLockType l (*lock);
 
-    auto newState = jcf::loadValueTreeFromXml (file);
+    auto newState = storage->load (file);
+    rememberFileState();
+
+    // the writer checks this too, so the newer file isn't replaced by our defaults
+    if (storage->isFromNewerVersion())
+        DBG ("jcf::AppOptions::load() file is from a newer version, it won't be saved over");
 
     if (! newState.isValid())
         return;
@@ -150,11 +423,139 @@ void jcf::AppOptions::load()
     {
         ScopedLock lock{ stateLock };
         preventTriggeringSave = true;
-        state.copyPropertiesFrom (newState, nullptr);
+
+        // rather than copyPropertiesFrom, which reports every property as changed, only touch
+        // the ones that differ.  setProperty ignores values that are the same
+        for (int i = state.getNumProperties(); --i >= 0;)
+        {
+            auto name = state.getPropertyName (i);
+
+            if (! newState.hasProperty (name))
+                state.removeProperty (name, nullptr);
+        }
+
+        for (int i = 0; i < newState.getNumProperties(); ++i)
+        {
+            auto name = newState.getPropertyName (i);
+            state.setProperty (name, newState[name], nullptr);
+        }
+
         preventTriggeringSave = false;
+        publishSnapshot();
+    }
+}
+
+void jcf::AppOptions::reloadIfChanged()
+{
+    // set first so a writer that's about to finish sees it
+    reloadCheckDeferred = true;
+
+    // held across the check and the load so the writer can't save in between.  If the writer
+    // has it we don't wait on a slow disk, it'll post the check again once it's done
+    ScopedTryLock fl{ fileAccessLock };
+
+    if (! fl.isLocked())
+        return;
+
+    reloadCheckDeferred = false;
+
+    {
+        InterProcessLock::ScopedLockType l (*lock);
+
+        if (! haveFilesChanged())
+            return;
+    }
+
+    load();
+}
+
+namespace
+{
+    const auto fnvOffsetBasis = (int64) 14695981039346656037ull;
+
+    // FNV-1a, which can be carried on over bytes appended to a file
+    int64 hashBytes (const void* data, size_t size, int64 hash)
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= static_cast<const uint8*> (data)[i];
+            hash = (int64) ((uint64) hash * 1099511628211ull);
+        }
+
+        return hash;
+    }
+
+    int64 hashFileContents (const File& f)
+    {
+        MemoryBlock data;
+        f.loadFileAsData (data); // a missing file hashes the same as an empty one
+        return hashBytes (data.getData(), data.getSize(), fnvOffsetBasis);
+    }
+} // namespace
+
+void jcf::AppOptions::rememberFileState()
+{
+    ScopedLock sl{ fileStateLock };
+
+    for (int i = 0; i < storedFiles.size(); ++i)
+    {
+        auto& f = storedFiles.getReference (i);
+        fileStates[(size_t) i] = { f.getLastModificationTime().toMilliseconds(), f.getSize(), hashFileContents (f) };
+    }
+}
+
+void jcf::AppOptions::rememberFileWritten (const File& writtenFile, const MemoryBlock& data, bool appended)
+{
+    ScopedLock sl{ fileStateLock };
+
+    auto index = storedFiles.indexOf (writtenFile);
+
+    if (index < 0)
+        return;
+
+    auto& fileState = fileStates[(size_t) index];
+    auto size = writtenFile.getSize();
+
+    if (! appended)
+    {
+        fileState = { writtenFile.getLastModificationTime().toMilliseconds(), size, hashBytes (data.getData(), data.getSize(), fnvOffsetBasis) };
+    }
+    else if (fileState.size >= 0 && size == fileState.size + (int64) data.getSize())
+    {
+        fileState = { writtenFile.getLastModificationTime().toMilliseconds(), size, hashBytes (data.getData(), data.getSize(), fileState.hash) };
+    }
+    else
+    {
+        // someone else appended since we last looked, so make sure the next check reloads
+        fileState = {};
     }
 }
 
+bool jcf::AppOptions::haveFilesChanged()
+{
+    ScopedLock sl{ fileStateLock };
+
+    bool changed = false;
+
+    for (int i = 0; i < storedFiles.size(); ++i)
+    {
+        auto& f = storedFiles.getReference (i);
+        auto& fileState = fileStates[(size_t) i];
+        auto modified = f.getLastModificationTime().toMilliseconds();
+        auto size = f.getSize();
+
+        if (modified == fileState.modified && size == fileState.size)
+            continue;
+
+        // touched but maybe not changed, e.g. another instance saving the same options
+        auto hash = hashFileContents (f);
+        changed = changed || hash != fileState.hash || fileState.size < 0;
+        fileState = { modified, size, hash };
+    }
+
+    return changed;
+}
+
 juce::Value jcf::AppOptions::getValueObject(const Identifier& identifier)
 {
     JUCE_ASSERT_MESSAGE_MANAGER_IS_LOCKED
@@ -203,6 +604,242 @@ void jcf::AppOptions::addListener (Listener* listener)
 void jcf::AppOptions::removeListener (Listener* listener)
 {
     listeners.remove(listener);
+
+    ScopedLock sl{ subscriptionLock };
+
+    for (auto& s : subscriptions)
+        s.second->remove (listener);
+}
+
+void jcf::AppOptions::addListener (const Identifier& identifier, Listener* listener)
+{
+    ScopedLock sl{ subscriptionLock };
+
+    auto& list = subscriptions[identifier];
+
+    if (list == nullptr)
+        list = std::make_unique<ListenerListType>();
+
+    list->add (listener);
+}
+
+void jcf::AppOptions::removeListener (const Identifier& identifier, Listener* listener)
+{
+    ScopedLock sl{ subscriptionLock };
+
+    auto it = subscriptions.find (identifier);
+
+    if (it != subscriptions.end())
+        it->second->remove (listener);
+}
+
+template <typename Callback>
+void jcf::AppOptions::callSubscribers (const Identifier& identifier, Callback&& callback)
+{
+    ListenerListType* list = nullptr;
+
+    {
+        ScopedLock sl{ subscriptionLock };
+
+        auto it = subscriptions.find (identifier);
+
+        if (it == subscriptions.end())
+            return;
+
+        list = it->second.get();
+    }
+
+    list->call (callback);
+}
+
+jcf::AppOptions::CachedBase::CachedBase (AppOptions& options_, const Identifier& identifier_) : identifier (identifier_), options (options_)
+{
+}
+
+jcf::AppOptions::CachedBase::~CachedBase()
+{
+    detach(); // should already have been done by the derived class
+}
+
+void jcf::AppOptions::CachedBase::detach()
+{
+    ScopedLock lock{ options.stateLock };
+
+    auto it = options.cachedValues.find (identifier);
+
+    if (it != options.cachedValues.end())
+        it->second.removeFirstMatchingValue (this);
+}
+
+void jcf::AppOptions::CachedBase::attach()
+{
+    ScopedLock lock{ options.stateLock };
+    options.cachedValues[identifier].add (this);
+    refresh (options.state[identifier]);
+}
+
+void jcf::AppOptions::refreshCachedValues (const Identifier& identifier)
+{
+    auto it = cachedValues.find (identifier);
+
+    if (it == cachedValues.end())
+        return;
+
+    auto& newValue = state[identifier];
+
+    for (auto* cached : it->second)
+        cached->refresh (newValue);
+}
+
+jcf::AppOptions::Snapshot::Snapshot (const ValueTree& state)
+{
+    values.reserve ((size_t) state.getNumProperties());
+
+    for (int i = 0; i < state.getNumProperties(); ++i)
+    {
+        auto name = state.getPropertyName (i);
+        values.emplace_back (name, state[name]);
+    }
+
+    std::sort (values.begin(), values.end(), [] (auto& a, auto& b) { return getKey (a.first) < getKey (b.first); });
+}
+
+jcf::AppOptions::Snapshot::Snapshot (const Snapshot& previous, const ValueTree& state, const std::set<Identifier>& changed)
+{
+    // the set is ordered by name, we need the order of the keys
+    std::vector<Identifier> sortedChanges (changed.begin(), changed.end());
+    std::sort (sortedChanges.begin(), sortedChanges.end(), [] (auto& a, auto& b) { return getKey (a) < getKey (b); });
+
+    values.reserve (previous.values.size() + sortedChanges.size());
+
+    // merge the two sorted lists, O(options + changes)
+    auto it = previous.values.begin();
+
+    for (auto& identifier : sortedChanges)
+    {
+        auto key = getKey (identifier);
+
+        while (it != previous.values.end() && getKey (it->first) < key)
+            values.push_back (*it++);
+
+        if (it != previous.values.end() && getKey (it->first) == key)
+            ++it; // replaced or removed
+
+        if (state.hasProperty (identifier))
+            values.emplace_back (identifier, state[identifier]);
+    }
+
+    values.insert (values.end(), it, previous.values.end());
+}
+
+const std::pair<Identifier, var>* jcf::AppOptions::Snapshot::find (const Identifier& identifier) const noexcept
+{
+    auto key = getKey (identifier);
+    auto it = std::lower_bound (values.begin(), values.end(), key, [] (auto& v, auto k) { return getKey (v.first) < k; });
+
+    if (it != values.end() && getKey (it->first) == key)
+        return &*it;
+
+    return nullptr;
+}
+
+const var& jcf::AppOptions::Snapshot::operator[] (const Identifier& identifier) const noexcept
+{
+    if (auto* v = find (identifier))
+        return v->second;
+
+    return missing;
+}
+
+bool jcf::AppOptions::Snapshot::contains (const Identifier& identifier) const noexcept
+{
+    return find (identifier) != nullptr;
+}
+
+jcf::AppOptions::SnapshotReader::SnapshotReader (const AppOptions& o) noexcept : options (o)
+{
+    // bounded by the number of slots, so still wait-free
+    for (int i = 0; i < numReaderSlots; ++i)
+    {
+        auto& slot = options.readerSlots[i];
+
+        if (! slot.inUse.load (std::memory_order_relaxed) && ! slot.inUse.exchange (true, std::memory_order_acquire))
+        {
+            slotIndex = i;
+            break;
+        }
+    }
+
+    if (slotIndex >= 0)
+        options.readerSlots[slotIndex].epoch.store (options.snapshotEpoch.load());
+    else
+        options.numOverflowReaders.fetch_add (1);
+
+    snapshot = options.currentSnapshot.load();
+}
+
+jcf::AppOptions::SnapshotReader::~SnapshotReader() noexcept
+{
+    if (slotIndex < 0)
+    {
+        options.numOverflowReaders.fetch_sub (1);
+        return;
+    }
+
+    auto& slot = options.readerSlots[slotIndex];
+    slot.epoch.store (0);
+    slot.inUse.store (false, std::memory_order_release);
+}
+
+void jcf::AppOptions::publishSnapshot()
+{
+    auto* previous = currentSnapshot.load();
+
+    if (previous != nullptr && snapshotChanges.empty())
+        return;
+
+    auto* next = previous == nullptr ? new Snapshot (state) : new Snapshot (*previous, state, snapshotChanges);
+    snapshotChanges.clear();
+
+    currentSnapshot.exchange (next);
+
+    // readers that see this epoch or later started after the exchange
+    auto retiredAt = snapshotEpoch.fetch_add (1) + 1;
+
+    if (previous != nullptr)
+        retiredSnapshots.emplace_back (previous, retiredAt);
+
+    reclaimSnapshots();
+}
+
+void jcf::AppOptions::reclaimSnapshots()
+{
+    if (! retiredSnapshots.empty() && numOverflowReaders.load() == 0)
+    {
+        auto oldestReader = std::numeric_limits<uint64>::max();
+
+        for (auto& slot : readerSlots)
+            if (auto epoch = slot.epoch.load())
+                oldestReader = jmin (oldestReader, epoch);
+
+        auto stillInUse = std::partition (retiredSnapshots.begin(), retiredSnapshots.end(), [oldestReader] (auto& s) { return s.second > oldestReader; });
+
+        for (auto it = stillInUse; it != retiredSnapshots.end(); ++it)
+            delete it->first;
+
+        retiredSnapshots.erase (stillInUse, retiredSnapshots.end());
+    }
+
+    if (retiredSnapshots.empty())
+        reclaimTimer.stopTimer();
+    else if (! reclaimTimer.isTimerRunning())
+        reclaimTimer.startTimer (100);
+}
+
+void jcf::AppOptions::ReclaimTimer::timerCallback()
+{
+    ScopedLock lock{ owner.stateLock };
+    owner.reclaimSnapshots();
 }
 
 void jcf::AppOptions::triggerTimer()
@@ -217,29 +854,107 @@ void jcf::AppOptions::timerCallback()
 
     {
         ScopedLock lock{ stateLock };
-        copyOfIds = identifiersThatChanged;
-        identifiersThatChanged.clear();
+        copyOfIds.swap (identifiersThatChanged);
     }
 
     DBG ("jcf::AppOptions::timerCallback()");
-    stopTimer(); // in case we get a modal loop in listeners.call
+    stopTimer();
 
-    save();
+    saveChanges (copyOfIds);
+}
+
+void jcf::AppOptions::handleAsyncUpdate()
+{
+    std::set<Identifier> copyOfIds;
+
+    {
+        ScopedLock lock{ stateLock };
+        copyOfIds.swap (identifiersToNotify);
+        publishSnapshot(); // once for everything changed since the last message loop turn
+    }
 
     for (auto& i : copyOfIds)
+    {
         listeners.call (&Listener::optionsChangedEarlyCallback, i);
+        callSubscribers (i, [&i] (Listener& l) { l.optionsChangedEarlyCallback (i); });
+    }
 
     for (auto& i : copyOfIds)
+    {
         listeners.call (&Listener::optionsChanged, i);
+        callSubscribers (i, [&i] (Listener& l) { l.optionsChanged (i); });
+    }
+}
+
+jcf::AppOptions::Transaction::Transaction (AppOptions& o) : options (o), lock (o.stateLock)
+{
+    ++options.transactionDepth;
+}
+
+jcf::AppOptions::Transaction::~Transaction()
+{
+    if (--options.transactionDepth == 0)
+        options.commitTransaction();
+}
+
+void jcf::AppOptions::Transaction::setOption (const Identifier& identifier, const var& value)
+{
+    auto& state = options.state;
+
+    if (! state.hasProperty (identifier) || ! value.equals (state[identifier]))
+        state.setProperty (identifier, value, nullptr);
+}
+
+void jcf::AppOptions::commitTransaction()
+{
+    if (transactionChanges.empty())
+        return;
+
+    for (auto& identifier : transactionChanges)
+    {
+        identifiersThatChanged.insert (identifier);
+        identifiersToNotify.insert (identifier);
+        refreshCachedValues (identifier);
+    }
+
+    transactionChanges.clear();
+
+    triggerTimer();
+    triggerAsyncUpdate();
+    publishSnapshot();
 }
 
 void jcf::AppOptions::valueTreePropertyChanged(ValueTree&, const Identifier& identifier)
 {
     ScopedLock lock{ stateLock };
 
+    // a set, so a burst of changes to one option can't grow it while we wait to publish
+    snapshotChanges.insert (identifier);
+
+    if (transactionDepth > 0)
+    {
+        transactionChanges.push_back (identifier);
+        return;
+    }
+
     DBG ("jcf::AppOptions::valueTreePropertyChanged() " + identifier);
-    triggerTimer();
-    identifiersThatChanged.insert(identifier);
+    // changes loaded from the file are passed on to the listeners but don't need saving
+    if (! preventTriggeringSave)
+    {
+        triggerTimer();
+        identifiersThatChanged.insert(identifier);
+    }
+
+    // the set coalesces repeated changes until the listeners are called
+    identifiersToNotify.insert (identifier);
+    triggerAsyncUpdate();
+
+    refreshCachedValues (identifier);
+
+    // the message thread publishes once per loop turn, but may be too busy to get there for a
+    // while, so changes from other threads would leave readers behind the Cached values
+    if (! MessageManager::existsAndIsCurrentThread())
+        publishSnapshot();
 }
 
 void jcf::AppOptions::valueTreeChildAdded (ValueTree&, ValueTree&)
@@ -261,4 +976,108 @@ void jcf::AppOptions::valueTreeParentChanged (ValueTree&)
 {
     triggerTimer();
 }
+
+class AppOptionsTests : public UnitTest
+{
+public:
+    AppOptionsTests() : UnitTest ("AppOptions") {}
+
+    void runTest() override
+    {
+        auto file = File::getSpecialLocation (File::tempDirectory).getNonexistentChildFile ("jcf_app_options_test", ".settings");
+        const Identifier a ("a"), b ("b");
+
+        {
+            AppOptions options (file);
+            RecordingListener listener;
+            options.addListener (&listener);
+
+            beginTest ("Listeners are called on the next message loop turn, not by setOption");
+            {
+                options.setOption (a, 1);
+                expect (listener.calls.isEmpty());
+
+                options.handleUpdateNowIfNeeded();
+                expectEquals (listener.takeCalls(), String ("early a,a"));
+            }
+
+            beginTest ("Repeated changes to an option are delivered once");
+            {
+                for (int i = 0; i < 10; ++i)
+                {
+                    options.setOption (a, i + 2);
+                    options.setOption (b, i + 2);
+                }
+
+                options.handleUpdateNowIfNeeded();
+                expectEquals (listener.takeCalls(), String ("early a,early b,a,b"));
+
+                options.handleUpdateNowIfNeeded();
+                expect (listener.calls.isEmpty());
+            }
+
+            beginTest ("A listener added for every option and subscribed to one");
+            {
+                options.addListener (a, &listener);
+                options.setOption (a, 100);
+                options.setOption (b, 100);
+                options.handleUpdateNowIfNeeded();
+
+                // the subscription is called after the listeners for every option
+                expectEquals (listener.takeCalls(), String ("early a,early a,early b,a,a,b"));
+
+                options.removeListener (&listener); // and its subscriptions
+                options.setOption (a, 101);
+                options.handleUpdateNowIfNeeded();
+                expect (listener.calls.isEmpty());
+            }
+
+            beginTest ("Reloading an identical file calls no listeners");
+            {
+                options.addListener (&listener);
+                options.save();
+                options.waitForPendingSaves();
+                options.handleUpdateNowIfNeeded();
+                listener.calls.clear();
+
+                options.load();
+                options.handleUpdateNowIfNeeded();
+                expect (listener.calls.isEmpty());
+
+                // touched but not changed by another instance
+                {
+                    AppOptions other (file);
+                    other.save();
+                    other.waitForPendingSaves();
+                }
+
+                options.reloadIfChanged();
+                options.handleUpdateNowIfNeeded();
+                expect (listener.calls.isEmpty());
+
+                options.removeListener (&listener);
+            }
+        }
+
+        file.deleteFile();
+    }
+
+private:
+    struct RecordingListener : public AppOptions::Listener
+    {
+        void optionsChangedEarlyCallback (const Identifier& id) override { calls.add ("early " + id.toString()); }
+        void optionsChanged (const Identifier& id) override { calls.add (id.toString()); }
+
+        String takeCalls()
+        {
+            auto joined = calls.joinIntoString (",");
+            calls.clear();
+            return joined;
+        }
+
+        StringArray calls;
+    };
+};
+
+static AppOptionsTests app_options_tests;
 }
\ No newline at end of file
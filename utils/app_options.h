@@ -1,6 +1,7 @@
 #pragma once
 #include <juce_core/juce_core.h>
 #include <juce_data_structures/juce_data_structures.h>
+#include "app_options_storage.h"
 
 namespace jcf
 {
@@ -8,24 +9,56 @@ namespace jcf
 /**
  * A ValueTree based alternative to the JUCE PropertiesFile for saving your application's
  * options.
+ *
+ * The file format is set by the storage, XML if none is given.  BinaryAppOptionsStorage is
+ * much quicker with large numbers of options and converts existing XML files automatically.
  */
-class AppOptions : public juce::ValueTree::Listener, juce::Timer, juce::ActionListener
+class AppOptions : public juce::ValueTree::Listener, juce::Timer, juce::ActionListener, juce::AsyncUpdater
 {
 public:
-	explicit AppOptions(const juce::File& file, bool readonly = false);
+	explicit AppOptions(const juce::File& file, bool readonly = false, std::unique_ptr<AppOptionsStorage> storage = nullptr);
 
     ~AppOptions();
 
+    /**
+     * Returns the AppOptions for the file shared by everything in this process, creating it
+     * if nobody holds it at the moment.  Use this rather than constructing your own when
+     * there may be many users of the same file, e.g. many instances of a plugin, so they share
+     * one copy of the state, one writer and one file watcher.
+     *
+     * Files are matched by their full path after following links.  readOnly and storage are
+     * only used when the object is created.  Release the last reference on the message thread.
+     */
+    static std::shared_ptr<AppOptions> getShared (const juce::File& file,
+                                                  bool readOnly = false,
+                                                  std::unique_ptr<AppOptionsStorage> storage = nullptr);
+
     void actionListenerCallback (const juce::String& message) override;
 
     void setOption (const juce::Identifier& identifier, juce::var value);
 
     const juce::var operator[] (const juce::Identifier& identifier) const;
 
+    /**
+     * Hands a copy of the options to the writer thread and returns without waiting for them
+     * to be written.  Saves that are still queued when the next one arrives are merged with it.
+     * Nothing is written while the file is in a newer format than we can read, see
+     * AppOptionsStorage::isFromNewerVersion().
+     */
     void save();
 
+    /** Blocks until any saves that have been handed to the writer thread are on disk. */
+    void waitForPendingSaves();
+
+    /**
+     * Reloads the file.  Only the options whose values differ from the current ones are
+     * changed, so listeners only hear about those.
+     */
     void load();
 
+    /** Reloads the file if it's been changed by someone else since we last loaded or saved it. */
+    void reloadIfChanged();
+
     juce::Value getValueObject (const juce::Identifier& identifier);
 
     /**
@@ -43,6 +76,11 @@ public:
                                                const juce::Array<juce::var>& permittedList,
                                                juce::var defaultValue);
 
+    /**
+     * Called on the message thread on the message loop turn after an option changes,
+     * once per option however many times it changed in between.  Saving happens separately,
+     * a second after the last change.
+     */
     class Listener
     {
     public:
@@ -52,19 +90,240 @@ public:
         virtual void optionsChanged (const juce::Identifier& identifierThatChanged) = 0;
     };
 
+    /** Adds a listener that hears about changes to every option. */
     void addListener (Listener* listener);
+
+    /** Removes the listener, including any subscriptions it has to individual options. */
     void removeListener (Listener* listener);
 
+    /**
+     * Adds a listener that only hears about changes to one option.  A listener can subscribe
+     * to several options, and is called after the listeners added for every option.  One that
+     * was also added for every option is called twice for the options it subscribed to.
+     */
+    void addListener (const juce::Identifier& identifier, Listener* listener);
+    void removeListener (const juce::Identifier& identifier, Listener* listener);
+
+    /** Base for Cached values, so AppOptions can refresh them whatever their type. */
+    class CachedBase
+    {
+    public:
+        CachedBase (AppOptions& options, const juce::Identifier& identifier);
+        virtual ~CachedBase();
+
+        const juce::Identifier identifier;
+
+    protected:
+        /** Adds us to the options, refreshing with the current value. */
+        void attach();
+
+        /**
+         * Removes us from the options.  Derived classes must call this in their destructor, as
+         * refresh() may be called from another thread until it returns.
+         */
+        void detach();
+
+        AppOptions& options;
+
+    private:
+        friend class AppOptions;
+
+        /** Called with stateLock held. */
+        virtual void refresh (const juce::var& newValue) = 0;
+    };
+
+    /**
+     * A typed copy of one option held in an atomic and refreshed by AppOptions whenever the
+     * option changes, so reading it is a single load with no Identifier lookup, lock or var
+     * conversion.  Use it for options read thousands of times a second, from any thread.
+     * ValueType must be something std::atomic holds lock free and a var converts to: bool,
+     * int, juce::int64, float or double.  Destroy it before the AppOptions.
+     *
+     * @code
+     * AppOptions::Cached<float> meterDecay { appOptions, "meterDecay", 0.5f };
+     * auto decay = meterDecay.get();
+     * @endcode
+     */
+    template <typename ValueType>
+    class Cached : public CachedBase
+    {
+    public:
+        Cached (AppOptions& options, const juce::Identifier& identifier, ValueType defaultValue = {})
+            : CachedBase (options, identifier), defaultValue (defaultValue), value (defaultValue)
+        {
+            attach();
+        }
+
+        ~Cached() override { detach(); }
+
+        ValueType get() const noexcept { return value.load (std::memory_order_relaxed); }
+
+        operator ValueType() const noexcept { return get(); }
+
+        void set (ValueType newValue) { options.setOption (identifier, newValue); }
+
+    private:
+        void refresh (const juce::var& newValue) override
+        {
+            value.store (newValue.isVoid() ? defaultValue : static_cast<ValueType> (newValue), std::memory_order_relaxed);
+        }
+
+        const ValueType defaultValue;
+        std::atomic<ValueType> value;
+
+        JUCE_DECLARE_NON_COPYABLE (Cached)
+    };
+
+    /**
+     * An immutable copy of all the options, so a Snapshot never changes once you can see it.
+     * Changes made on the message thread are published in batches, once per message loop turn
+     * in which options changed.  Changes made on other threads, and the end of a load() or
+     * Transaction, are published straight away.  Each new Snapshot is built from the previous
+     * one and the changed options, not from scratch, so prefer a Transaction for many changes
+     * from another thread.
+     */
+    class Snapshot
+    {
+    public:
+        /** Returns the option's value, or a void var if it isn't set.  Never locks or allocates. */
+        const juce::var& operator[] (const juce::Identifier& identifier) const noexcept;
+
+        bool contains (const juce::Identifier& identifier) const noexcept;
+
+    private:
+        friend class AppOptions;
+
+        explicit Snapshot (const juce::ValueTree& state);
+
+        /** Copies previous, updating the changed options from the state. */
+        Snapshot (const Snapshot& previous, const juce::ValueTree& state, const std::set<juce::Identifier>& changed);
+
+        /** Identifiers with the same name share a pooled string, so its address is enough to order them. */
+        static const void* getKey (const juce::Identifier& identifier) noexcept { return identifier.getCharPointer().getAddress(); }
+
+        const std::pair<juce::Identifier, juce::var>* find (const juce::Identifier& identifier) const noexcept;
+
+        /** Sorted by the address of the pooled identifier string. */
+        std::vector<std::pair<juce::Identifier, juce::var>> values;
+        juce::var missing;
+    };
+
+    /**
+     * Gives wait-free, allocation-free access to the current Snapshot from any thread,
+     * including the audio thread.  Creating one claims a reader slot and records the current
+     * epoch, with no locks.  Keep it short lived, for example for a single processBlock, as
+     * snapshots replaced while it exists can't be deleted until it goes.
+     *
+     * Changes made on the message thread only reach readers at the end of that message loop
+     * turn, whereas operator[] and Cached values see them at once.  So until then a reader may
+     * disagree with a Cached handle for the same option.
+     *
+     * @code
+     * AppOptions::SnapshotReader options (appOptions);
+     * auto gain = float (options[gainId]);
+     * @endcode
+     */
+    class SnapshotReader
+    {
+    public:
+        explicit SnapshotReader (const AppOptions& options) noexcept;
+        ~SnapshotReader() noexcept;
+
+        const juce::var& operator[] (const juce::Identifier& identifier) const noexcept { return (*snapshot)[identifier]; }
+
+        const Snapshot& operator*() const noexcept { return *snapshot; }
+        const Snapshot* operator->() const noexcept { return snapshot; }
+
+    private:
+        const AppOptions& options;
+        const Snapshot* snapshot;
+        int slotIndex{ -1 }; // -1 if all the slots were taken
+
+        JUCE_DECLARE_NON_COPYABLE (SnapshotReader)
+    };
+
+    /**
+     * Applies a batch of changes, for example an imported settings profile, with a single
+     * round of bookkeeping instead of one per option.  The options stay locked while the
+     * Transaction exists.  When the last Transaction goes the snapshot is published, the
+     * Cached values refreshed and one save and one notification pass are queued for all the
+     * changes.  Transactions can be nested, and setOption() may be used within one.
+     *
+     * @code
+     * {
+     *     AppOptions::Transaction t (appOptions);
+     *
+     *     for (auto& p : profile)
+     *         t.setOption (p.name, p.value);
+     * }
+     * @endcode
+     */
+    class Transaction
+    {
+    public:
+        explicit Transaction (AppOptions& options);
+        ~Transaction();
+
+        void setOption (const juce::Identifier& identifier, const juce::var& value);
+
+    private:
+        AppOptions& options;
+        const juce::ScopedLock lock;
+
+        JUCE_DECLARE_NON_COPYABLE (Transaction)
+    };
+
 private:
+    friend class AppOptionsBenchmark;
+    friend class AppOptionsTests;
+
     /** This was formerly public, but there's a massive issue with loading
      * preferences if we have Value objects based on properties. */
     juce::ValueTree state;
     juce::CriticalSection stateLock;
 
+    /**
+     * Saves after the given properties changed, letting the storage write only the changes.
+     * Like save() this is done on the writer thread.
+     */
+    void saveChanges (const std::set<juce::Identifier>& changed);
+
+    /** Tells other AppOptions objects for the same file that it's been saved.  Can be called from any thread. */
+    void broadcastSave();
+
+    /** Records the files' state after we've loaded them, reading them all.  Call with fileAccessLock and the InterProcessLock held. */
+    void rememberFileState();
+
+    /**
+     * Records the state of a file the storage has just replaced or appended to, from the bytes
+     * written rather than by reading it back.  Called on the writer thread with the
+     * InterProcessLock held.
+     */
+    void rememberFileWritten (const juce::File& writtenFile, const juce::MemoryBlock& data, bool appended);
+
+    /** Returns true if the files differ from when we last loaded or saved them.  Call with fileAccessLock and the InterProcessLock held. */
+    bool haveFilesChanged();
+
+    /** Publishes a new snapshot if any options have changed since the last.  Call with stateLock held. */
+    void publishSnapshot();
+
+    /**
+     * Deletes the retired snapshots that no reader can be using, and keeps trying on a timer
+     * while any are left.  Call with stateLock held.
+     */
+    void reclaimSnapshots();
+
+    /** Refreshes any Cached values for the identifier.  Call with stateLock held. */
+    void refreshCachedValues (const juce::Identifier& identifier);
+
     void triggerTimer();
 
+    /** Saves the options changed since the last save.  Saving is debounced by a second. */
     void timerCallback() override;
 
+    /** Tells the listeners about the options changed since the last message loop turn. */
+    void handleAsyncUpdate() override;
+
     void valueTreePropertyChanged (juce::ValueTree&, const juce::Identifier& identifier) override;
 
     void valueTreeChildAdded (juce::ValueTree&, juce::ValueTree&) override;
@@ -74,18 +333,112 @@ private:
 
     bool readOnly{ false };
     juce::File file;
-    std::set<juce::Identifier> identifiersThatChanged;
+    std::unique_ptr<AppOptionsStorage> storage;
+    std::set<juce::Identifier> identifiersThatChanged; // since the last save
+    std::set<juce::Identifier> identifiersToNotify;    // since the listeners were last called
     bool preventTriggeringSave{};
 
     class ThreadSafeValueProxy;
 
     std::unique_ptr<juce::InterProcessLock> lock;
 
-    juce::ListenerList<Listener, juce::Array<Listener*, juce::CriticalSection>> listeners;
-    int suppressCallback{ 0 };
+    using ListenerListType = juce::ListenerList<Listener, juce::Array<Listener*, juce::CriticalSection>>;
+    ListenerListType listeners;
+
+    /** Calls the listeners subscribed to the identifier. */
+    template <typename Callback>
+    void callSubscribers (const juce::Identifier& identifier, Callback&& callback);
+
+    /*
+     * Entries are never removed, so a list can't disappear while it's being called.  The lock
+     * guards the map, the lists have their own.
+     */
+    std::map<juce::Identifier, std::unique_ptr<ListenerListType>> subscriptions;
+    juce::CriticalSection subscriptionLock;
+
+    /** The modification time and size are cheap to check before hashing the contents. */
+    struct FileState
+    {
+        juce::int64 modified{ -1 }, size{ -1 }, hash{ 0 };
+    };
+
+    /*
+     * The InterProcessLock only keeps other processes out, within a process it just counts
+     * entries.  This keeps the writer thread from saving between the message thread checking
+     * the files and loading them, which could revert newer changes.  Taken before the
+     * InterProcessLock and before stateLock.  The message thread only tries it, as the writer
+     * holds it through slow writes.
+     */
+    juce::CriticalSection fileAccessLock;
+
+    /** Set when reloadIfChanged() found the writer busy, so the writer checks again when it's done. */
+    std::atomic<bool> reloadCheckDeferred{ false };
+
+    /** Runs a deferred reloadIfChanged() on the message thread. */
+    struct DeferredReload : public juce::AsyncUpdater
+    {
+        explicit DeferredReload (AppOptions& o) : owner (o) {}
+        void handleAsyncUpdate() override { owner.reloadIfChanged(); }
+        AppOptions& owner;
+    };
+
+    DeferredReload deferredReload{ *this };
+
+    juce::CriticalSection fileStateLock;
+    juce::Array<juce::File> storedFiles; // storage->getFiles (file)
+    std::vector<FileState> fileStates;   // one for each of storedFiles
+
+    /** Watches the files for changes by other processes.  Only implemented on Linux. */
+    class FileWatcher;
+    std::unique_ptr<FileWatcher> fileWatcher;
+
+    /** Writes the files in the background so slow disks don't hold up the message thread. */
+    class Writer;
+    std::unique_ptr<Writer> writer;
 
     std::unique_ptr<ThreadSafeValueProxy> valueProxy;
 
+    /*
+     * Each reader takes a slot and stores the current epoch in it before loading
+     * currentSnapshot.  Publishing bumps the epoch after swapping the snapshot, and the old
+     * one is retired with the new epoch.  A reader whose epoch is at least that must have
+     * loaded the new snapshot, so a retired snapshot can be deleted once every reader from
+     * before it has gone, however many newer readers there are.  If all the slots are taken
+     * readers fall back to a count, and nothing is deleted while it's non-zero.
+     */
+    struct alignas (64) ReaderSlot
+    {
+        std::atomic<bool> inUse{ false };
+        std::atomic<juce::uint64> epoch{ 0 }; // zero when idle
+    };
+
+    static constexpr int numReaderSlots = 64;
+    mutable ReaderSlot readerSlots[numReaderSlots];
+    mutable std::atomic<int> numOverflowReaders{ 0 };
+    std::atomic<juce::uint64> snapshotEpoch{ 1 };
+
+    std::atomic<const Snapshot*> currentSnapshot{ nullptr };
+    std::vector<std::pair<const Snapshot*, juce::uint64>> retiredSnapshots; // and the epoch they were retired at
+    std::set<juce::Identifier> snapshotChanges;                             // since the last publish
+
+    /** Retries reclaiming snapshots that readers were still using. */
+    struct ReclaimTimer : public juce::Timer
+    {
+        explicit ReclaimTimer (AppOptions& o) : owner (o) {}
+        void timerCallback() override;
+        AppOptions& owner;
+    };
+
+    ReclaimTimer reclaimTimer{ *this };
+
+    int transactionDepth{ 0 };
+    std::vector<juce::Identifier> transactionChanges; // may contain duplicates
+
+    /** Does the bookkeeping for the changes made during the transactions.  Call with stateLock held. */
+    void commitTransaction();
+
+    std::map<juce::Identifier, juce::Array<CachedBase*>> cachedValues;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (AppOptions)
 };
 
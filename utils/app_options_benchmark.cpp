@@ -0,0 +1,334 @@
+#include "app_options_benchmark.h"
+namespace jcf
+{
+
+namespace
+{
+    struct CountingListener : public AppOptions::Listener
+    {
+        void optionsChanged (const Identifier&) override { ++numCalls; }
+        int numCalls{ 0 };
+    };
+} // namespace
+
+var AppOptionsBenchmark::run (const File& workingDirectory, const Settings& settings)
+{
+    JUCE_ASSERT_MESSAGE_MANAGER_IS_LOCKED
+
+    workingDirectory.createDirectory();
+
+    Array<var> results;
+
+    for (auto& storage : settings.storages)
+        for (auto numKeys : settings.keyCounts)
+            results.add (runForKeyCount (workingDirectory, storage, numKeys, settings));
+
+    auto* root = new DynamicObject();
+    root->setProperty ("benchmark", "AppOptions");
+    root->setProperty ("time", Time::getCurrentTime().toISO8601 (true));
+    root->setProperty ("numReaderThreads", settings.numReaderThreads);
+    root->setProperty ("numWriterThreads", settings.numWriterThreads);
+    root->setProperty ("results", results);
+    return root;
+}
+
+Result AppOptionsBenchmark::runAndWriteJson (const File& workingDirectory, const File& jsonFile, const Settings& settings)
+{
+    return benchmark::writeJson (run (workingDirectory, settings), jsonFile);
+}
+
+var AppOptionsBenchmark::runForKeyCount (const File& workingDirectory, const Settings::Storage& storage, int numKeys, const Settings& settings)
+{
+    auto& createStorage = storage.create;
+    auto file = workingDirectory.getChildFile ("app_options_benchmark_" + storage.name + "_" + String (numKeys) + ".settings");
+
+    file.deleteFile();
+    JournalledAppOptionsStorage::getJournalFile (file).deleteFile();
+
+    // made up front so the interning of the names isn't timed
+    Array<Identifier> ids;
+
+    for (int i = 0; i < numKeys; ++i)
+        ids.add (Identifier ("option" + String (i)));
+
+    auto* result = new DynamicObject();
+    result->setProperty ("storage", storage.name);
+    result->setProperty ("numKeys", numKeys);
+
+    {
+        AppOptions options (file, false, createStorage());
+
+        auto start = Time::getHighResolutionTicks();
+
+        for (int i = 0; i < numKeys; ++i)
+            options.setOption (ids[i], i);
+
+        result->setProperty ("setOptionNewKeyPerKey", benchmark::microsecondsSince (start) / numKeys);
+
+        options.save();
+        options.waitForPendingSaves();
+    }
+
+    {
+        auto start = Time::getHighResolutionTicks();
+        AppOptions options (file, false, createStorage());
+        result->setProperty ("constructAndLoad", benchmark::microsecondsSince (start));
+    }
+
+    AppOptions options (file, false, createStorage());
+    var sink;
+
+    {
+        auto start = Time::getHighResolutionTicks();
+
+        for (int i = 0; i < settings.numReads; ++i)
+            sink = options[ids[i % numKeys]];
+
+        result->setProperty ("operatorIndexPerRead", benchmark::microsecondsSince (start) / settings.numReads);
+    }
+
+    {
+        auto start = Time::getHighResolutionTicks();
+
+        for (int i = 0; i < settings.numReads; ++i)
+        {
+            AppOptions::SnapshotReader reader (options);
+            sink = reader[ids[i % numKeys]];
+        }
+
+        result->setProperty ("snapshotReadPerRead", benchmark::microsecondsSince (start) / settings.numReads);
+    }
+
+    {
+        // the same option read through operator[] with a conversion, and through a Cached handle
+        AppOptions::Cached<int> cached (options, ids[0]);
+        int total = 0;
+
+        auto start = Time::getHighResolutionTicks();
+
+        for (int i = 0; i < settings.numReads; ++i)
+            total += (int) options[ids[0]];
+
+        result->setProperty ("operatorIndexSameKeyPerRead", benchmark::microsecondsSince (start) / settings.numReads);
+
+        start = Time::getHighResolutionTicks();
+
+        for (int i = 0; i < settings.numReads; ++i)
+            total += cached.get();
+
+        result->setProperty ("cachedGetPerRead", benchmark::microsecondsSince (start) / settings.numReads);
+        sink = total; // so the reads can't be optimised away
+    }
+
+    {
+        auto start = Time::getHighResolutionTicks();
+
+        for (int i = 0; i < numKeys; ++i)
+            options.setOption (ids[i], i + 1);
+
+        result->setProperty ("setOptionPerKey", benchmark::microsecondsSince (start) / numKeys);
+    }
+
+    {
+        auto start = Time::getHighResolutionTicks();
+
+        {
+            AppOptions::Transaction transaction (options);
+
+            for (int i = 0; i < numKeys; ++i)
+                transaction.setOption (ids[i], i + 2);
+        }
+
+        result->setProperty ("transactionPerKey", benchmark::microsecondsSince (start) / numKeys);
+    }
+
+    result->setProperty ("importProfile", measureImport (options, ids));
+
+    {
+        options.waitForPendingSaves();
+
+        auto start = Time::getHighResolutionTicks();
+        options.save();
+        result->setProperty ("saveHandOff", benchmark::microsecondsSince (start));
+
+        options.waitForPendingSaves();
+        result->setProperty ("saveToDisk", benchmark::microsecondsSince (start));
+    }
+
+    result->setProperty ("listenerFanOut", measureListenerFanOut (options, ids, settings));
+
+    {
+        Array<Value> values;
+        auto start = Time::getHighResolutionTicks();
+
+        for (auto& id : ids)
+            values.add (options.getValueObject (id));
+
+        result->setProperty ("bindValueObjectPerKey", benchmark::microsecondsSince (start) / numKeys);
+    }
+
+    {
+        std::vector<std::unique_ptr<AppOptions>> instances;
+        auto start = Time::getHighResolutionTicks();
+
+        for (int i = 0; i < settings.numInstances; ++i)
+            instances.push_back (std::make_unique<AppOptions> (file, true, createStorage()));
+
+        result->setProperty ("constructSeparateInstances", benchmark::microsecondsSince (start));
+    }
+
+    {
+        std::vector<std::shared_ptr<AppOptions>> instances;
+        auto start = Time::getHighResolutionTicks();
+
+        for (int i = 0; i < settings.numInstances; ++i)
+            instances.push_back (AppOptions::getShared (file, true, createStorage()));
+
+        result->setProperty ("constructSharedInstances", benchmark::microsecondsSince (start));
+    }
+
+    result->setProperty ("lockContention", measureLockContention (options, ids, settings));
+    result->setProperty ("fileSizeBytes", file.getSize());
+
+    options.waitForPendingSaves();
+    return result;
+}
+
+var AppOptionsBenchmark::measureImport (AppOptions& options, const Array<Identifier>& ids)
+{
+    auto* result = new DynamicObject();
+    auto numChanges = jmin (2000, ids.size());
+    int generation = 2000;
+
+    CountingListener listener;
+    options.addListener (&listener);
+    options.handleUpdateNowIfNeeded(); // so only our changes are delivered
+
+    // a settings profile of numChanges keys, including the notification pass that follows
+    auto timeImport = [&] (bool useTransaction)
+    {
+        ++generation;
+        auto start = Time::getHighResolutionTicks();
+
+        if (useTransaction)
+        {
+            AppOptions::Transaction transaction (options);
+
+            for (int i = 0; i < numChanges; ++i)
+                transaction.setOption (ids[i], generation);
+        }
+        else
+        {
+            for (int i = 0; i < numChanges; ++i)
+                options.setOption (ids[i], generation);
+        }
+
+        options.handleUpdateNowIfNeeded();
+        return benchmark::microsecondsSince (start);
+    };
+
+    result->setProperty ("numChanges", numChanges);
+    result->setProperty ("setOption", timeImport (false));
+    result->setProperty ("transaction", timeImport (true));
+    result->setProperty ("listenerCalls", listener.numCalls);
+
+    options.removeListener (&listener);
+    return result;
+}
+
+var AppOptionsBenchmark::measureListenerFanOut (AppOptions& options, const Array<Identifier>& ids, const Settings& settings)
+{
+    auto* result = new DynamicObject();
+    auto numChanges = jmin (100, ids.size());
+    int generation = 1000;
+
+    options.handleUpdateNowIfNeeded(); // so only our changes are delivered
+
+    auto timeNotification = [&]
+    {
+        for (int i = 0; i < numChanges; ++i)
+            options.setOption (ids[i], ++generation);
+
+        auto start = Time::getHighResolutionTicks();
+        options.handleUpdateNowIfNeeded();
+        return benchmark::microsecondsSince (start);
+    };
+
+    std::vector<CountingListener> listeners ((size_t) settings.numListeners);
+
+    for (auto& l : listeners)
+        options.addListener (&l);
+
+    result->setProperty ("numChanges", numChanges);
+    result->setProperty ("globalListeners", timeNotification());
+
+    for (auto& l : listeners)
+        options.removeListener (&l);
+
+    // each listener subscribes to one option, spread over all the options
+    for (size_t i = 0; i < listeners.size(); ++i)
+        options.addListener (ids[(int) i % ids.size()], &listeners[i]);
+
+    result->setProperty ("subscribedListeners", timeNotification());
+
+    for (auto& l : listeners)
+        options.removeListener (&l);
+
+    return result;
+}
+
+var AppOptionsBenchmark::measureLockContention (AppOptions& options, const Array<Identifier>& ids, const Settings& settings)
+{
+    std::atomic<bool> finished{ false };
+    std::vector<std::unique_ptr<LightweightThread>> threads;
+
+    for (int t = 0; t < settings.numReaderThreads; ++t)
+    {
+        threads.push_back (std::make_unique<LightweightThread> (
+            [&, t] (Thread*)
+            {
+                var sink;
+
+                for (int i = t; ! finished.load (std::memory_order_relaxed); ++i)
+                    sink = options[ids[i % ids.size()]];
+            }));
+    }
+
+    for (int t = 0; t < settings.numWriterThreads; ++t)
+    {
+        threads.push_back (std::make_unique<LightweightThread> (
+            [&, t] (Thread*)
+            {
+                for (int i = t; ! finished.load (std::memory_order_relaxed); ++i)
+                    options.setOption (ids[i % ids.size()], i);
+            }));
+    }
+
+    // the time the probe waits to take the lock reflects how long the others hold it
+    std::vector<double> waits;
+    auto end = Time::getMillisecondCounterHiRes() + settings.contentionMilliseconds;
+
+    while (Time::getMillisecondCounterHiRes() < end)
+    {
+        auto start = Time::getHighResolutionTicks();
+
+        {
+            const ScopedLock sl (options.stateLock);
+            waits.push_back (benchmark::microsecondsSince (start));
+        }
+
+        Thread::yield();
+    }
+
+    finished = true;
+    threads.clear();
+
+    options.handleUpdateNowIfNeeded();
+    options.waitForPendingSaves();
+
+    auto* result = new DynamicObject();
+    result->setProperty ("stateLockWait", benchmark::summarise (waits));
+    return result;
+}
+
+} // namespace jcf
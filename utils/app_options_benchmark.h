@@ -0,0 +1,63 @@
+#pragma once
+#include <juce_core/juce_core.h>
+#include "app_options.h"
+#include "benchmark_utils.h"
+
+namespace jcf
+{
+
+/**
+ * Measures how AppOptions scales with the number of options, so changes to it can be compared.
+ * Enable with JCF_BENCHMARKS=1 and call run() from a small app or test runner.
+ *
+ * For each storage and key count it times constructing (loading) the options, operator[],
+ * snapshot reads, Cached<T>::get(), setOption, a Transaction, importing a profile of up to
+ * 2000 keys with and without a Transaction, saving, listener fan-out to global and per-option
+ * listeners, binding Value objects and constructing many instances with and without
+ * getShared().  It also runs reader and writer threads against one AppOptions while a probe
+ * thread times how long it waits for stateLock.  Times are in microseconds unless the name
+ * says otherwise.
+ *
+ * Must be called on the message thread.  It creates and deletes files in workingDirectory.
+ */
+class AppOptionsBenchmark
+{
+public:
+    struct Settings
+    {
+        juce::Array<int> keyCounts{ 100, 1000, 10000 };
+        int numReads{ 100000 };
+        int numListeners{ 100 };
+        int numInstances{ 50 };
+        int numReaderThreads{ 4 };
+        int numWriterThreads{ 2 };
+        int contentionMilliseconds{ 500 };
+
+        struct Storage
+        {
+            juce::String name;
+            std::function<std::unique_ptr<AppOptionsStorage>()> create;
+        };
+
+        /** The storages to compare, each is run for every key count. */
+        std::vector<Storage> storages{
+            { "xml", [] { return std::make_unique<XmlAppOptionsStorage>(); } },
+            { "binary", [] { return std::make_unique<BinaryAppOptionsStorage>(); } },
+            { "journalled", [] { return std::make_unique<JournalledAppOptionsStorage>(); } },
+        };
+    };
+
+    /** Runs the benchmark, returning the results as an object suitable for JSON::toString(). */
+    static juce::var run (const juce::File& workingDirectory, const Settings& settings);
+
+    /** Runs the benchmark and writes the results to a JSON file. */
+    static juce::Result runAndWriteJson (const juce::File& workingDirectory, const juce::File& jsonFile, const Settings& settings);
+
+private:
+    static juce::var runForKeyCount (const juce::File& workingDirectory, const Settings::Storage& storage, int numKeys, const Settings& settings);
+    static juce::var measureImport (AppOptions& options, const juce::Array<juce::Identifier>& ids);
+    static juce::var measureListenerFanOut (AppOptions& options, const juce::Array<juce::Identifier>& ids, const Settings& settings);
+    static juce::var measureLockContention (AppOptions& options, const juce::Array<juce::Identifier>& ids, const Settings& settings);
+};
+
+} // namespace jcf
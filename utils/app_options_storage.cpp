@@ -0,0 +1,292 @@
+#include "app_options_storage.h"
+namespace jcf
+{
+using namespace juce;
+
+Result writeFileAtomically (const File& file, const MemoryBlock& data)
+{
+    TemporaryFile temp (file);
+
+    {
+        FileOutputStream out (temp.getFile());
+
+        if (! out.openedOk())
+            return Result::fail ("could not write to " + temp.getFile().getFullPathName());
+
+        if (! out.write (data.getData(), data.getSize()))
+            return Result::fail ("could not write to " + temp.getFile().getFullPathName());
+
+        out.flush();
+
+        if (out.getStatus().failed())
+            return out.getStatus();
+    }
+
+    if (! temp.overwriteTargetFileWithTemporary())
+        return Result::fail ("Save failed to " + file.getFullPathName());
+
+    return Result::ok();
+}
+
+Result AppOptionsStorage::saveChanges (const File& file, const ValueTree& state, const std::set<Identifier>&)
+{
+    return save (file, state);
+}
+
+void AppOptionsStorage::fileWritten (const File& file, const MemoryBlock& data, bool appended)
+{
+    if (onFileWritten)
+        onFileWritten (file, data, appended);
+}
+
+Result AppOptionsStorage::replaceFile (const File& file, const MemoryBlock& data)
+{
+    auto result = writeFileAtomically (file, data);
+
+    if (result.wasOk())
+        fileWritten (file, data, false);
+
+    return result;
+}
+
+ValueTree XmlAppOptionsStorage::load (const File& file)
+{
+    return jcf::loadValueTreeFromXml (file);
+}
+
+Result XmlAppOptionsStorage::save (const File& file, const ValueTree& state)
+{
+    MemoryOutputStream out;
+    out.writeText (state.toXmlString(), false, false, nullptr);
+    return replaceFile (file, out.getMemoryBlock());
+}
+
+bool BinaryAppOptionsStorage::isBinaryFormat (const MemoryBlock& data)
+{
+    if (data.getSize() < headerSize)
+        return false;
+
+    MemoryInputStream in (data, false);
+    return in.readInt() == magicNumber;
+}
+
+ValueTree BinaryAppOptionsStorage::load (const File& file)
+{
+    fromNewerVersion = false;
+    MemoryBlock data;
+
+    if (! file.loadFileAsData (data))
+        return {};
+
+    if (! isBinaryFormat (data))
+    {
+        // probably a file from before we switched to binary, it'll be converted on the next save
+        if (auto xml = std::unique_ptr<XmlElement> (XmlDocument (data.toString()).getDocumentElement()))
+            return ValueTree::fromXml (*xml);
+
+        return {};
+    }
+
+    MemoryInputStream in (data, false);
+    in.readInt(); // magic number
+
+    if (in.readInt() > formatVersion)
+    {
+        fromNewerVersion = true;
+        return {};
+    }
+
+    return ValueTree::readFromStream (in);
+}
+
+Result BinaryAppOptionsStorage::save (const File& file, const ValueTree& state)
+{
+    MemoryOutputStream out;
+    out.writeInt (magicNumber);
+    out.writeInt (formatVersion);
+    state.writeToStream (out);
+    return replaceFile (file, out.getMemoryBlock());
+}
+
+namespace
+{
+    /** FNV-1a, enough to spot a torn or garbled journal record. */
+    uint32 journalChecksum (const void* data, size_t size)
+    {
+        auto hash = (uint32) 2166136261u;
+
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash ^= static_cast<const uint8*> (data)[i];
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+
+    enum JournalOp
+    {
+        journalRemove = 0,
+        journalSet = 1
+    };
+} // namespace
+
+JournalledAppOptionsStorage::JournalledAppOptionsStorage (std::unique_ptr<AppOptionsStorage> snapshotStorage, int64 compactionThresholdBytes)
+    : snapshotStorage (std::move (snapshotStorage)), compactionThresholdBytes (compactionThresholdBytes)
+{
+    if (this->snapshotStorage == nullptr)
+        this->snapshotStorage = std::make_unique<BinaryAppOptionsStorage>();
+
+    this->snapshotStorage->onFileWritten = [this] (const File& f, const MemoryBlock& data, bool appended) { fileWritten (f, data, appended); };
+}
+
+File JournalledAppOptionsStorage::getJournalFile (const File& file)
+{
+    return file.getSiblingFile (file.getFileName() + ".journal");
+}
+
+ValueTree JournalledAppOptionsStorage::load (const File& file)
+{
+    auto state = snapshotStorage->load (file);
+    fromNewerVersion = snapshotStorage->isFromNewerVersion();
+
+    // the journal belongs to the newer snapshot, leave it alone
+    if (fromNewerVersion)
+        return {};
+
+    auto journal = getJournalFile (file);
+
+    if (! journal.existsAsFile())
+        return state;
+
+    auto replayed = state.isValid() ? state : ValueTree{ "state" };
+    int64 validLength = 0;
+    auto numReplayed = replayJournal (journal, replayed, validLength);
+
+    if (validLength < journal.getSize() && ! truncateJournal (journal, validLength))
+        journalNeedsCompaction = true;
+
+    if (numReplayed == 0)
+        return state;
+
+    return replayed;
+}
+
+int JournalledAppOptionsStorage::replayJournal (const File& journal, ValueTree& state, int64& validLength)
+{
+    MemoryBlock data;
+    validLength = 0;
+
+    if (! journal.loadFileAsData (data))
+        return 0;
+
+    MemoryInputStream in (data, false);
+    int numReplayed = 0;
+
+    while (in.getNumBytesRemaining() >= 8)
+    {
+        auto size = in.readInt();
+        auto checksum = (uint32) in.readInt();
+
+        if (size <= 0 || size > in.getNumBytesRemaining())
+            break; // cut short mid-write
+
+        auto* record = static_cast<const char*> (data.getData()) + in.getPosition();
+
+        if (journalChecksum (record, (size_t) size) != checksum)
+            break;
+
+        MemoryInputStream recordStream (record, (size_t) size, false);
+        Identifier id (recordStream.readString());
+
+        if (recordStream.readByte() == journalSet)
+            state.setProperty (id, var::readFromStream (recordStream), nullptr);
+        else
+            state.removeProperty (id, nullptr);
+
+        in.skipNextBytes (size);
+        ++numReplayed;
+        validLength = in.getPosition();
+    }
+
+    return numReplayed;
+}
+
+bool JournalledAppOptionsStorage::truncateJournal (const File& journal, int64 validLength)
+{
+    if (validLength == 0)
+        return journal.deleteFile();
+
+    FileOutputStream out (journal);
+
+    return out.openedOk() && out.setPosition (validLength) && out.truncate().wasOk();
+}
+
+Result JournalledAppOptionsStorage::save (const File& file, const ValueTree& state)
+{
+    auto result = snapshotStorage->save (file, state);
+
+    // if we crash before deleting the journal it's replayed onto a snapshot that already has
+    // its changes, which does no harm
+    if (result.wasOk())
+    {
+        journalNeedsCompaction = ! getJournalFile (file).deleteFile();
+
+        if (! journalNeedsCompaction)
+            fileWritten (getJournalFile (file), {}, false);
+    }
+
+    return result;
+}
+
+Result JournalledAppOptionsStorage::saveChanges (const File& file, const ValueTree& state, const std::set<Identifier>& changed)
+{
+    if (! file.existsAsFile() || changed.empty() || journalNeedsCompaction)
+        return save (file, state);
+
+    MemoryOutputStream batch;
+
+    for (auto& id : changed)
+    {
+        MemoryOutputStream record;
+        record.writeString (id.toString());
+
+        if (state.hasProperty (id))
+        {
+            record.writeByte ((char) journalSet);
+            state[id].writeToStream (record);
+        }
+        else
+        {
+            record.writeByte ((char) journalRemove);
+        }
+
+        batch.writeInt ((int) record.getDataSize());
+        batch.writeInt ((int) journalChecksum (record.getData(), record.getDataSize()));
+        batch.write (record.getData(), record.getDataSize());
+    }
+
+    auto journal = getJournalFile (file);
+
+    {
+        FileOutputStream out (journal); // appends
+
+        if (! out.openedOk())
+            return Result::fail ("could not write to " + journal.getFullPathName());
+
+        out.write (batch.getData(), batch.getDataSize());
+        out.flush();
+
+        if (out.getStatus().failed())
+            return out.getStatus();
+    }
+
+    fileWritten (journal, batch.getMemoryBlock(), true);
+
+    if (journal.getSize() > compactionThresholdBytes)
+        return save (file, state);
+
+    return Result::ok();
+}
+
+} // namespace jcf
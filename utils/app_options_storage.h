@@ -0,0 +1,131 @@
+#pragma once
+#include <juce_core/juce_core.h>
+#include <juce_data_structures/juce_data_structures.h>
+
+namespace jcf
+{
+
+/**
+ * How AppOptions reads and writes its file.  Implementations are called with the
+ * InterProcessLock for the file held.
+ */
+class AppOptionsStorage
+{
+public:
+    virtual ~AppOptionsStorage() = default;
+
+    /** Returns an invalid ValueTree if the file doesn't exist or can't be read. */
+    virtual juce::ValueTree load (const juce::File& file) = 0;
+
+    virtual juce::Result save (const juce::File& file, const juce::ValueTree& state) = 0;
+
+    /**
+     * Called instead of save() when only the given properties have changed since the last
+     * save, so backends that can write just the changes may do so.  Saves everything by default.
+     */
+    virtual juce::Result saveChanges (const juce::File& file, const juce::ValueTree& state, const std::set<juce::Identifier>& changed);
+
+    /** Returns every file the options are stored in, so they can be watched for changes. */
+    virtual juce::Array<juce::File> getFiles (const juce::File& file) { return { file }; }
+
+    /**
+     * True if the last load() found a file written in a newer format than this version
+     * understands.  AppOptions won't save over such a file, as it would lose the options.
+     */
+    bool isFromNewerVersion() const noexcept { return fromNewerVersion; }
+
+    /**
+     * Called with the bytes written each time one of the files is replaced or appended to, so
+     * AppOptions can fingerprint its own saves without reading the files back.  A deleted file
+     * is reported as replaced with nothing.
+     */
+    std::function<void (const juce::File& file, const juce::MemoryBlock& data, bool appended)> onFileWritten;
+
+protected:
+    void fileWritten (const juce::File& file, const juce::MemoryBlock& data, bool appended);
+
+    /** Replaces the file atomically with the data and reports it to onFileWritten. */
+    juce::Result replaceFile (const juce::File& file, const juce::MemoryBlock& data);
+
+    bool fromNewerVersion{ false };
+};
+
+/** The original format, the ValueTree as XML text. */
+class XmlAppOptionsStorage : public AppOptionsStorage
+{
+public:
+    juce::ValueTree load (const juce::File& file) override;
+    juce::Result save (const juce::File& file, const juce::ValueTree& state) override;
+};
+
+/**
+ * A compact binary format, a small header followed by ValueTree::writeToStream.  Much quicker
+ * to load and save than XML with thousands of options.  Files in the XML format are still
+ * loaded, and are converted to binary on the next save.
+ */
+class BinaryAppOptionsStorage : public AppOptionsStorage
+{
+public:
+    juce::ValueTree load (const juce::File& file) override;
+    juce::Result save (const juce::File& file, const juce::ValueTree& state) override;
+
+    /** Returns true if the data starts with our header. */
+    static bool isBinaryFormat (const juce::MemoryBlock& data);
+
+    static constexpr juce::int32 magicNumber = 0x4f46434a; // "JCFO"
+    static constexpr juce::int32 formatVersion = 1;
+    static constexpr size_t headerSize = 8;
+};
+
+/**
+ * Appends each batch of changes to a journal file next to the snapshot instead of rewriting
+ * the whole file, so saving costs O(changes) rather than O(options).  When the journal grows
+ * past compactionThresholdBytes it's folded into a new snapshot and deleted.  Loading reads
+ * the snapshot and replays the journal on top.
+ *
+ * Journal records are checksummed and replay stops at the first bad record, so a write cut
+ * short only loses the last batch of changes, never the snapshot.  Loading truncates the
+ * journal at a bad record so later batches aren't appended after it and lost too.
+ */
+class JournalledAppOptionsStorage : public AppOptionsStorage
+{
+public:
+    /** The snapshot is saved with BinaryAppOptionsStorage if no snapshotStorage is given. */
+    explicit JournalledAppOptionsStorage (std::unique_ptr<AppOptionsStorage> snapshotStorage = nullptr,
+                                          juce::int64 compactionThresholdBytes = 64 * 1024);
+
+    juce::ValueTree load (const juce::File& file) override;
+
+    /** Writes a full snapshot and deletes the journal. */
+    juce::Result save (const juce::File& file, const juce::ValueTree& state) override;
+
+    juce::Result saveChanges (const juce::File& file, const juce::ValueTree& state, const std::set<juce::Identifier>& changed) override;
+
+    juce::Array<juce::File> getFiles (const juce::File& file) override { return { file, getJournalFile (file) }; }
+
+    static juce::File getJournalFile (const juce::File& file);
+
+private:
+    /**
+     * Applies the journal to the state, returns the number of records replayed.  validLength
+     * is set to the size of the journal up to the first bad record.
+     */
+    static int replayJournal (const juce::File& journal, juce::ValueTree& state, juce::int64& validLength);
+
+    /** Cuts off a bad tail left by a write that was cut short.  Returns false if it couldn't. */
+    static bool truncateJournal (const juce::File& journal, juce::int64 validLength);
+
+    std::unique_ptr<AppOptionsStorage> snapshotStorage;
+    juce::int64 compactionThresholdBytes;
+
+    /** Set if a bad journal couldn't be truncated, so the next save must be a full one. */
+    bool journalNeedsCompaction{ false };
+};
+
+/**
+ * Writes to a temporary file next to the target then renames it over the target, so a reader
+ * never sees a half-written file.
+ */
+juce::Result writeFileAtomically (const juce::File& file, const juce::MemoryBlock& data);
+
+} // namespace jcf
@@ -0,0 +1,44 @@
+#pragma once
+#include <juce_core/juce_core.h>
+
+namespace jcf
+{
+
+/** Timing helpers shared by the benchmarks. */
+namespace benchmark
+{
+inline double microsecondsSince (juce::int64 startTicks)
+{
+    return juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks() - startTicks) * 1.0e6;
+}
+
+/** Returns the count, p50, p99 and max of the samples, which are sorted in place. */
+inline juce::var summarise (std::vector<double>& samples)
+{
+    auto* summary = new juce::DynamicObject();
+
+    if (samples.empty())
+        return summary;
+
+    std::sort (samples.begin(), samples.end());
+
+    auto percentile = [&samples] (double p) { return samples[(size_t) (p * (double) (samples.size() - 1))]; };
+
+    summary->setProperty ("count", (int) samples.size());
+    summary->setProperty ("p50", percentile (0.5));
+    summary->setProperty ("p99", percentile (0.99));
+    summary->setProperty ("max", samples.back());
+    return summary;
+}
+
+/** Writes the results of a benchmark to a JSON file. */
+inline juce::Result writeJson (const juce::var& results, const juce::File& jsonFile)
+{
+    if (! jsonFile.replaceWithText (juce::JSON::toString (results)))
+        return juce::Result::fail ("could not write to " + jsonFile.getFullPathName());
+
+    return juce::Result::ok();
+}
+} // namespace benchmark
+
+} // namespace jcf
@@ -0,0 +1,356 @@
+#pragma once
+#include <juce_core/juce_core.h>
+#include <juce_events/juce_events.h>
+#include "other_utils.h"
+
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#define JCF_COROUTINES_AVAILABLE 1
+
+namespace jcf
+{
+
+/**
+ * Recycles coroutine frames so a workflow with many short-lived tasks doesn't go to the system
+ * allocator for every call.  Frames are kept on a free list per size class of 128 bytes up to
+ * maxPooledSize, larger frames use the normal allocator.  At most maxFramesPerSizeClass idle
+ * frames are kept per size class.
+ */
+class CoroutineFrameAllocator
+{
+public:
+    static void* allocate (size_t size)
+    {
+        if (size > maxPooledSize)
+            return ::operator new (size);
+
+        auto& sizeClass = getSizeClass (size);
+
+        {
+            const juce::SpinLock::ScopedLockType sl (sizeClass.lock);
+
+            if (auto* frame = sizeClass.freeList)
+            {
+                sizeClass.freeList = frame->next;
+                --sizeClass.numFree;
+                return frame;
+            }
+        }
+
+        return ::operator new (getRoundedSize (size));
+    }
+
+    static void deallocate (void* p, size_t size)
+    {
+        if (size > maxPooledSize)
+        {
+            ::operator delete (p);
+            return;
+        }
+
+        auto& sizeClass = getSizeClass (size);
+
+        {
+            const juce::SpinLock::ScopedLockType sl (sizeClass.lock);
+
+            if (sizeClass.numFree < maxFramesPerSizeClass)
+            {
+                auto* frame = static_cast<FreeFrame*> (p);
+                frame->next = sizeClass.freeList;
+                sizeClass.freeList = frame;
+                ++sizeClass.numFree;
+                return;
+            }
+        }
+
+        ::operator delete (p);
+    }
+
+    static constexpr size_t granularity = 128;
+    static constexpr size_t maxPooledSize = 4096;
+    static constexpr int maxFramesPerSizeClass = 64;
+
+private:
+    struct FreeFrame
+    {
+        FreeFrame* next;
+    };
+
+    struct SizeClass
+    {
+        juce::SpinLock lock;
+        FreeFrame* freeList{ nullptr };
+        int numFree{ 0 };
+    };
+
+    static size_t getRoundedSize (size_t size) { return (size + granularity - 1) / granularity * granularity; }
+
+    static SizeClass& getSizeClass (size_t size)
+    {
+        // never deleted, frames can be freed during static destruction
+        static auto* sizeClasses = new SizeClass[maxPooledSize / granularity];
+        return sizeClasses[getRoundedSize (size) / granularity - 1];
+    }
+};
+
+template <typename ResultType = void>
+class Task;
+
+namespace coroutine
+{
+struct PromiseBase
+{
+    static void* operator new (size_t size) { return CoroutineFrameAllocator::allocate (size); }
+    static void operator delete (void* p, size_t size) { CoroutineFrameAllocator::deallocate (p, size); }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template <typename PromiseType>
+        std::coroutine_handle<> await_suspend (std::coroutine_handle<PromiseType> handle) noexcept
+        {
+            auto& promise = handle.promise();
+
+            if (promise.continuation)
+                return promise.continuation;
+
+            if (promise.detached)
+                handle.destroy();
+
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() noexcept
+    {
+        exception = std::current_exception();
+
+        // no one can rethrow it once the frame's gone, so don't let it vanish quietly
+        if (detached)
+            reportDetachedException();
+    }
+
+    void reportDetachedException() noexcept
+    {
+        juce::String message ("jcf::Task started with start() threw ");
+
+        try
+        {
+            std::rethrow_exception (exception);
+        }
+        catch (const std::exception& e)
+        {
+            message << e.what();
+        }
+        catch (...)
+        {
+            message << "an unknown exception";
+        }
+
+        juce::Logger::writeToLog (message);
+        jassertfalse;
+    }
+
+    void rethrowIfFailed()
+    {
+        if (exception)
+            std::rethrow_exception (exception);
+    }
+
+    std::coroutine_handle<> continuation;
+    bool detached{ false };
+    std::exception_ptr exception;
+};
+
+template <typename ResultType>
+struct Promise : PromiseBase
+{
+    Task<ResultType> get_return_object() noexcept;
+
+    template <typename Value>
+    void return_value (Value&& value)
+    {
+        result.emplace (std::forward<Value> (value));
+    }
+
+    ResultType takeResult()
+    {
+        rethrowIfFailed();
+        return std::move (*result);
+    }
+
+    std::optional<ResultType> result;
+};
+
+template <>
+struct Promise<void> : PromiseBase
+{
+    Task<void> get_return_object() noexcept;
+
+    void return_void() noexcept {}
+
+    void takeResult() { rethrowIfFailed(); }
+};
+} // namespace coroutine
+
+/**
+ * A lazily started coroutine returning a ResultType.  A Task does nothing until it's either
+ * co_awaited from another coroutine, which resumes the awaiting coroutine directly when the
+ * task completes, or detached with start(), which runs it to completion and then frees it.
+ *
+ * Combine with resumeOnMessageThread() and resumeOnBackground() to hop between threads in a
+ * straight line of code rather than a chain of nested lambdas:
+ *
+ * @code
+ * jcf::Task<> rescan (jcf::LightweightThreadPool& pool)
+ * {
+ *     co_await jcf::resumeOnBackground (pool);
+ *     auto files = findPresets();
+ *     co_await jcf::resumeOnMessageThread();
+ *     presetList.setFiles (files);
+ * }
+ *
+ * rescan (pool).start();
+ * @endcode
+ *
+ * Frames come from the CoroutineFrameAllocator.  Anything a task refers to must outlive it.
+ */
+template <typename ResultType>
+class Task
+{
+public:
+    using promise_type = coroutine::Promise<ResultType>;
+
+    Task (Task&& other) noexcept : handle (std::exchange (other.handle, {})) {}
+
+    Task& operator= (Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+                handle.destroy();
+
+            handle = std::exchange (other.handle, {});
+        }
+
+        return *this;
+    }
+
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    /**
+     * Starts the task without waiting for it.  The frame is freed when it completes.  There's
+     * no one to rethrow an exception the task doesn't catch, so it's logged and asserts.
+     */
+    void start() &&
+    {
+        jassert (handle);
+        auto h = std::exchange (handle, {});
+        h.promise().detached = true;
+        h.resume();
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct Awaiter
+        {
+            bool await_ready() noexcept { return ! handle || handle.done(); }
+
+            std::coroutine_handle<> await_suspend (std::coroutine_handle<> awaitingCoroutine) noexcept
+            {
+                handle.promise().continuation = awaitingCoroutine;
+                return handle;
+            }
+
+            ResultType await_resume() { return handle.promise().takeResult(); }
+
+            std::coroutine_handle<promise_type> handle;
+        };
+
+        return Awaiter{ handle };
+    }
+
+private:
+    friend promise_type;
+
+    explicit Task (std::coroutine_handle<promise_type> h) noexcept : handle (h) {}
+
+    std::coroutine_handle<promise_type> handle;
+
+    JUCE_DECLARE_NON_COPYABLE (Task)
+};
+
+namespace coroutine
+{
+template <typename ResultType>
+Task<ResultType> Promise<ResultType>::get_return_object() noexcept
+{
+    return Task<ResultType> (std::coroutine_handle<Promise>::from_promise (*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept
+{
+    return Task<void> (std::coroutine_handle<Promise>::from_promise (*this));
+}
+} // namespace coroutine
+
+/**
+ * co_await this to continue on the message thread.  Doesn't suspend if we're already on it.
+ * If there's no message manager the coroutine carries on in the current thread.
+ */
+inline auto resumeOnMessageThread() noexcept
+{
+    struct Awaiter
+    {
+        bool await_ready() const noexcept { return juce::MessageManager::existsAndIsCurrentThread(); }
+
+        bool await_suspend (std::coroutine_handle<> handle)
+        {
+            if (juce::MessageManager::callAsync ([handle] { handle.resume(); }))
+                return true;
+
+            jassertfalse; // no message manager
+            return false;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    return Awaiter{};
+}
+
+/** co_await this to continue on one of the pool's threads.  The pool must outlive the task. */
+inline auto resumeOnBackground (LightweightThreadPool& pool) noexcept
+{
+    struct Awaiter
+    {
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend (std::coroutine_handle<> handle) { pool.post ([handle] { handle.resume(); }); }
+
+        void await_resume() const noexcept {}
+
+        LightweightThreadPool& pool;
+    };
+
+    return Awaiter{ pool };
+}
+
+} // namespace jcf
+
+#endif
@@ -0,0 +1,191 @@
+#pragma once
+#include <juce_core/juce_core.h>
+
+namespace jcf
+{
+
+/**
+ * Like DelayedSharedResourcePointer but with one shared object per key, e.g. one image per
+ * image file or one font per font file.
+ *
+ * get() returns a strong handle to the object for a key, constructing it with the factory if
+ * nobody currently holds it.  The cache itself only keeps weak references, so an object is
+ * deleted, and its entry removed, when the last handle goes.  Optionally the most recently
+ * used retentionBudget objects are kept alive by the cache as well, so a resource that is
+ * dropped and picked up again soon after isn't rebuilt.
+ *
+ * It's thread-safe.  If several threads ask for the same key at once the object is only
+ * constructed once and the other threads wait for it.  Constructing one key doesn't block
+ * requests for other keys.  KeyType needs an operator<.  The handles may outlive the cache.
+ */
+template <typename KeyType, typename ObjectType>
+class KeyedSharedResourceCache
+{
+public:
+    using Factory = std::function<std::unique_ptr<ObjectType> (const KeyType&)>;
+
+    explicit KeyedSharedResourceCache (Factory factory, int retentionBudget = 0) : factory (std::move (factory))
+    {
+        state->retentionBudget = retentionBudget;
+    }
+
+    ~KeyedSharedResourceCache() { clearRetained(); }
+
+    /** Returns the object for the key, constructing it if needed.  Returns nullptr if the factory does. */
+    std::shared_ptr<ObjectType> get (const KeyType& key)
+    {
+        std::vector<std::shared_ptr<ObjectType>> released; // dropped last, after the locks
+        std::shared_ptr<Entry> entry;
+
+        {
+            const juce::ScopedLock sl (state->lock);
+
+            auto& e = state->entries[key];
+
+            if (e == nullptr)
+                e = std::make_shared<Entry>();
+
+            entry = e;
+
+            if (auto existing = entry->object.lock())
+                return retain (key, existing, released);
+        }
+
+        const juce::ScopedLock constructionLock (entry->constructionLock);
+
+        {
+            const juce::ScopedLock sl (state->lock);
+
+            // someone else constructed it while we were waiting
+            if (auto existing = entry->object.lock())
+                return retain (key, existing, released);
+        }
+
+        auto newObject = factory (key);
+
+        if (newObject == nullptr)
+        {
+            // only the deleter removes entries, so without this every key that fails, e.g. a
+            // missing file, would leave one behind.  Ours and the map's are the only references
+            // unless someone is waiting to try again
+            const juce::ScopedLock sl (state->lock);
+
+            auto it = state->entries.find (key);
+
+            if (it != state->entries.end() && it->second == entry && entry->object.expired() && entry.use_count() == 2)
+                state->entries.erase (it);
+
+            return {};
+        }
+
+        std::shared_ptr<ObjectType> object (newObject.release(),
+                                            [weakState = std::weak_ptr<State> (state), key] (ObjectType* o)
+                                            {
+                                                delete o;
+
+                                                if (auto s = weakState.lock())
+                                                    s->removeIfExpired (key);
+                                            });
+
+        const juce::ScopedLock sl (state->lock);
+        entry->object = object;
+        return retain (key, object, released);
+    }
+
+    /** Returns the number of keys that currently have an object. */
+    int getNumObjects() const
+    {
+        const juce::ScopedLock sl (state->lock);
+
+        int count = 0;
+
+        for (auto& e : state->entries)
+            if (! e.second->object.expired())
+                ++count;
+
+        return count;
+    }
+
+    void setRetentionBudget (int newBudget)
+    {
+        std::vector<std::shared_ptr<ObjectType>> released;
+
+        {
+            const juce::ScopedLock sl (state->lock);
+            state->retentionBudget = juce::jmax (0, newBudget);
+            state->trimRetained (released);
+        }
+    }
+
+    /** Stops keeping recently used objects alive.  Those without any handles are deleted. */
+    void clearRetained() { setRetentionBudget (0); }
+
+private:
+    struct Entry
+    {
+        juce::CriticalSection constructionLock;
+        std::weak_ptr<ObjectType> object; // guarded by State::lock
+    };
+
+    struct State
+    {
+        /** Called by the deleter once the last handle to an object has gone. */
+        void removeIfExpired (const KeyType& key)
+        {
+            const juce::ScopedLock sl (lock);
+
+            auto it = entries.find (key);
+
+            // if anyone else holds the entry they're about to construct a new object for it
+            if (it != entries.end() && it->second->object.expired() && it->second.use_count() == 1)
+                entries.erase (it);
+        }
+
+        /** Call with the lock held.  The released objects must be dropped after unlocking. */
+        void trimRetained (std::vector<std::shared_ptr<ObjectType>>& released)
+        {
+            while ((int) retained.size() > retentionBudget)
+            {
+                released.push_back (std::move (retained.back().second));
+                retained.pop_back();
+            }
+        }
+
+        juce::CriticalSection lock;
+        std::map<KeyType, std::shared_ptr<Entry>> entries;
+        std::list<std::pair<KeyType, std::shared_ptr<ObjectType>>> retained; // most recently used first
+        int retentionBudget{ 0 };
+    };
+
+    /**
+     * Call with the lock held.  Moves the object to the front of the retained list, adding any
+     * objects that fall off the end to released.
+     */
+    std::shared_ptr<ObjectType> retain (const KeyType& key,
+                                        const std::shared_ptr<ObjectType>& object,
+                                        std::vector<std::shared_ptr<ObjectType>>& released)
+    {
+        if (state->retentionBudget == 0)
+            return object;
+
+        auto& retained = state->retained;
+        auto it = std::find_if (retained.begin(), retained.end(), [&key] (auto& r) { return ! (r.first < key) && ! (key < r.first); });
+
+        if (it != retained.end())
+        {
+            retained.splice (retained.begin(), retained, it);
+            return object;
+        }
+
+        retained.emplace_front (key, object);
+        state->trimRetained (released);
+        return object;
+    }
+
+    std::shared_ptr<State> state{ std::make_shared<State>() };
+    Factory factory;
+
+    JUCE_DECLARE_NON_COPYABLE (KeyedSharedResourceCache)
+};
+
+} // namespace jcf
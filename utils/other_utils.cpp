@@ -3,6 +3,13 @@
 //
 
 #include "other_utils.h"
+
+#if JUCE_LINUX
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 namespace jcf
 {
 using namespace juce;
@@ -12,6 +19,19 @@ LightweightThread::LightweightThread (std::function<void (Thread*)> func, int th
     startThread (Priority::normal);
 }
 
+LightweightThread::LightweightThread (std::function<void (Thread*)> func, const Options& options)
+    : Thread (options.name, options.stackSize), func (std::move (func)), threadExitTime (options.threadExitTime), options (options)
+{
+    if (! startThread (options.priority))
+    {
+        optionsResult = Result::fail ("the thread could not be started");
+        return;
+    }
+
+    if (options.scheduling != Options::Scheduling::normal || options.affinityMask != 0)
+        optionsApplied.wait();
+}
+
 LightweightThread::~LightweightThread()
 {
     stopThread (threadExitTime);
@@ -19,9 +39,236 @@ LightweightThread::~LightweightThread()
 
 void LightweightThread::run()
 {
+    if (options.scheduling != Options::Scheduling::normal || options.affinityMask != 0)
+    {
+        optionsResult = applyOptions();
+        optionsApplied.signal();
+    }
+
     func (this);
 }
 
+/**
+ * Owns detached LightweightThreads until they've finished, deleting them one at a time on its
+ * own thread.  Deleted at shutdown, blocking until the remaining threads are done.
+ */
+class ThreadReaper : public Thread, private DeletedAtShutdown
+{
+public:
+    ThreadReaper() : Thread ("lc thread reaper") { startThread (Priority::low); }
+
+    ~ThreadReaper() override
+    {
+        signalThreadShouldExit();
+        notify();
+        waitForThreadToExit (-1); // run() empties the queue before returning
+        clearSingletonInstance();
+    }
+
+    void add (std::unique_ptr<LightweightThread> thread, std::function<void()> onComplete)
+    {
+        thread->signalThreadShouldExit();
+
+        {
+            const ScopedLock sl (lock);
+            queue.push_back ({ std::move (thread), std::move (onComplete) });
+        }
+
+        notify();
+    }
+
+    void run() override
+    {
+        for (;;)
+        {
+            Item item;
+
+            {
+                const ScopedLock sl (lock);
+
+                if (! queue.empty())
+                {
+                    item = std::move (queue.front());
+                    queue.pop_front();
+                }
+            }
+
+            if (item.thread == nullptr)
+            {
+                if (threadShouldExit())
+                    return;
+
+                wait (-1);
+                continue;
+            }
+
+            item.thread.reset(); // blocks here, rather than on the message thread
+
+            if (item.onComplete != nullptr && MessageManager::getInstanceWithoutCreating() != nullptr)
+                MessageManager::callAsync (std::move (item.onComplete));
+        }
+    }
+
+    JUCE_DECLARE_SINGLETON (ThreadReaper, false)
+
+private:
+    struct Item
+    {
+        std::unique_ptr<LightweightThread> thread;
+        std::function<void()> onComplete;
+    };
+
+    CriticalSection lock;
+    std::deque<Item> queue;
+};
+
+JUCE_IMPLEMENT_SINGLETON (ThreadReaper)
+
+void LightweightThread::detach (std::unique_ptr<LightweightThread> thread, std::function<void()> onComplete)
+{
+    if (thread != nullptr)
+        ThreadReaper::getInstance()->add (std::move (thread), std::move (onComplete));
+}
+
+void LightweightThread::Detacher::operator() (LightweightThread* thread) const
+{
+    if (thread != nullptr)
+    {
+        auto onComplete = std::move (thread->onDetachedCompletion);
+        detach (std::unique_ptr<LightweightThread> (thread), std::move (onComplete));
+    }
+}
+
+Result LightweightThread::getOptionsResult() const
+{
+    return optionsResult;
+}
+
+Result LightweightThread::applyOptions()
+{
+#if JUCE_LINUX
+    auto thread = pthread_self();
+
+    if (options.scheduling != Options::Scheduling::normal)
+    {
+        auto policy = options.scheduling == Options::Scheduling::fifo ? SCHED_FIFO : SCHED_RR;
+
+        sched_param param{};
+        param.sched_priority = jlimit (sched_get_priority_min (policy), sched_get_priority_max (policy), options.realtimePriority);
+
+        if (auto error = pthread_setschedparam (thread, policy, &param))
+            return Result::fail ("pthread_setschedparam failed: " + String (strerror (error)));
+
+        int actualPolicy = 0;
+        sched_param actualParam{};
+        pthread_getschedparam (thread, &actualPolicy, &actualParam);
+
+        if (actualPolicy != policy || actualParam.sched_priority != param.sched_priority)
+            return Result::fail ("realtime scheduling did not take effect");
+    }
+
+    if (options.affinityMask != 0)
+    {
+        cpu_set_t cpus;
+        CPU_ZERO (&cpus);
+
+        for (int i = 0; i < 32; ++i)
+            if ((options.affinityMask & (1u << i)) != 0)
+                CPU_SET (i, &cpus);
+
+        if (auto error = pthread_setaffinity_np (thread, sizeof (cpus), &cpus))
+            return Result::fail ("pthread_setaffinity_np failed: " + String (strerror (error)));
+
+        cpu_set_t actualCpus;
+        CPU_ZERO (&actualCpus);
+        pthread_getaffinity_np (thread, sizeof (actualCpus), &actualCpus);
+
+        if (! CPU_EQUAL (&cpus, &actualCpus))
+            return Result::fail ("CPU affinity did not take effect");
+    }
+
+    return Result::ok();
+#else
+    if (options.affinityMask != 0)
+        Thread::setCurrentThreadAffinityMask (options.affinityMask);
+
+    if (options.scheduling != Options::Scheduling::normal)
+        return Result::fail ("realtime scheduling policies are only supported on Linux");
+
+    return Result::ok();
+#endif
+}
+
+class LightweightTask::Job : public ThreadPoolJob
+{
+public:
+    Job (std::function<void (ThreadPoolJob*)> func) : ThreadPoolJob ("lc lightweight task"), func (std::move (func)) {}
+
+    JobStatus runJob() override
+    {
+        func (this);
+        return jobHasFinished;
+    }
+
+private:
+    std::function<void (ThreadPoolJob*)> func;
+};
+
+LightweightTask::LightweightTask (ThreadPool& pool, std::function<void (ThreadPoolJob*)> func, int taskExitTime)
+    : pool (pool), job (std::make_unique<Job> (std::move (func))), taskExitTime (taskExitTime)
+{
+    pool.addJob (job.get(), false);
+}
+
+LightweightTask::~LightweightTask()
+{
+    if (! pool.removeJob (job.get(), true, taskExitTime))
+    {
+        // the task didn't respond to shouldExit() in time, we can't delete it while it's running
+        jassertfalse;
+        pool.waitForJobToFinish (job.get(), -1);
+    }
+}
+
+bool LightweightTask::join (int timeOutMilliseconds)
+{
+    return pool.waitForJobToFinish (job.get(), timeOutMilliseconds);
+}
+
+bool LightweightTask::isFinished() const
+{
+    return ! pool.contains (job.get());
+}
+
+void LightweightTask::signalTaskShouldExit()
+{
+    job->signalJobShouldExit();
+}
+
+LightweightThreadPool::LightweightThreadPool (int numberOfThreads) : pool (jmax (1, numberOfThreads))
+{
+}
+
+LightweightThreadPool::~LightweightThreadPool()
+{
+    pool.removeAllJobs (true, 20000);
+}
+
+std::unique_ptr<LightweightTask> LightweightThreadPool::submit (std::function<void (ThreadPoolJob*)> func, int taskExitTime)
+{
+    return std::unique_ptr<LightweightTask> (new LightweightTask (pool, std::move (func), taskExitTime));
+}
+
+void LightweightThreadPool::post (std::function<void()> func)
+{
+    pool.addJob (std::move (func));
+}
+
+int LightweightThreadPool::getNumThreads() const
+{
+    return pool.getNumThreads();
+}
+
 ApplicationActivtyMonitor::ApplicationActivtyMonitor (int timeoutSeconds) : timeout (timeoutSeconds)
 {
     startTimer (1000);
@@ -135,33 +382,83 @@ RateLimitedCallback::RateLimitedCallback (std::function<void()> function, int ra
 {
 }
 
+RateLimitedCallback::RateLimitedCallback (std::function<void()> function, RateLimitedCallbackGroup& group)
+    : function (function), rateLimitMilliSeconds (0), group (&group)
+{
+    group.addCallback (this);
+}
+
 RateLimitedCallback::~RateLimitedCallback()
 {
     stopTimer();
     JUCE_ASSERT_MESSAGE_MANAGER_IS_LOCKED; // async updater
+
+    if (group != nullptr)
+        group->removeCallback (this);
 }
 
 void RateLimitedCallback::trigger()
 {
-    triggerAsyncUpdate();
+    // only the trigger that sets the flag posts a message, everyone else piggybacks on it
+    if (! updatePending.exchange (true, std::memory_order_acq_rel))
+    {
+        if (group != nullptr)
+            group->requestFrame();
+        else
+            triggerAsyncUpdate();
+    }
 }
 
 void RateLimitedCallback::setRateLimit (int milliseconds)
 {
     rateLimitMilliSeconds = milliseconds;
+
+    // the adaptive interval is clamped between the two
+    maximumRateLimitMilliSeconds = jmax (maximumRateLimitMilliSeconds, milliseconds);
+}
+
+void RateLimitedCallback::setAdaptiveRateLimit (float target, int maximumMilliSeconds)
+{
+    jassert (target > 0.0f && target <= 1.0f);
+    targetUtilisation = jlimit (0.01f, 1.0f, target);
+    maximumRateLimitMilliSeconds = jmax (rateLimitMilliSeconds, maximumMilliSeconds);
+}
+
+void RateLimitedCallback::disableAdaptiveRateLimit()
+{
+    targetUtilisation = 0.0f;
+}
+
+int RateLimitedCallback::getCurrentRateLimit() const
+{
+    if (targetUtilisation <= 0.0f)
+        return rateLimitMilliSeconds;
+
+    // each cycle is the cost of the call plus the timer interval, so for a utilisation of
+    // cost / (cost + interval) the interval has to be cost * (1 - target) / target
+    auto interval = averageCostMilliSeconds * (1.0 - targetUtilisation) / targetUtilisation;
+    return jlimit (rateLimitMilliSeconds, maximumRateLimitMilliSeconds, roundToInt (interval));
+}
+
+void RateLimitedCallback::callFunctionAndStartTimer()
+{
+    auto start = Time::getMillisecondCounterHiRes();
+    function();
+    auto cost = Time::getMillisecondCounterHiRes() - start;
+
+    // smoothed so one slow call doesn't stall updates for a long time
+    averageCostMilliSeconds += 0.25 * (cost - averageCostMilliSeconds);
+
+    startTimer (getCurrentRateLimit());
 }
 
 void RateLimitedCallback::handleAsyncUpdate()
 {
+    // if the timer is running the flag stays set and timerCallback() picks it up
     if (! isTimerRunning())
     {
-        function();
-        startTimer (rateLimitMilliSeconds);
-    }
-    else
-    {
-        // startTimer(rateLimitMilliSeconds);
-        updatePending = true;
+        updatePending.store (false, std::memory_order_release);
+        callFunctionAndStartTimer();
     }
 }
 
@@ -169,13 +466,86 @@ void RateLimitedCallback::timerCallback()
 {
     stopTimer();
 
-    if (updatePending)
+    if (updatePending.exchange (false, std::memory_order_acq_rel))
+        callFunctionAndStartTimer();
+}
+
+RateLimitedCallbackGroup::RateLimitedCallbackGroup (int framesPerSecond) : framesPerSecond (framesPerSecond)
+{
+}
+
+RateLimitedCallbackGroup::~RateLimitedCallbackGroup()
+{
+    stopTimer();
+    JUCE_ASSERT_MESSAGE_MANAGER_IS_LOCKED; // async updater
+
+    // the callbacks hold a pointer to us, delete them first
+    jassert (callbacks.isEmpty());
+}
+
+void RateLimitedCallbackGroup::setFrameRate (int newFramesPerSecond)
+{
+    framesPerSecond = newFramesPerSecond;
+
+    if (isTimerRunning())
+        startTimerHz (framesPerSecond);
+}
+
+void RateLimitedCallbackGroup::addCallback (RateLimitedCallback* callback)
+{
+    JUCE_ASSERT_MESSAGE_MANAGER_IS_LOCKED
+    callbacks.add (callback);
+}
+
+void RateLimitedCallbackGroup::removeCallback (RateLimitedCallback* callback)
+{
+    JUCE_ASSERT_MESSAGE_MANAGER_IS_LOCKED
+    callbacks.removeFirstMatchingValue (callback);
+}
+
+void RateLimitedCallbackGroup::requestFrame()
+{
+    if (! frameRequested.exchange (true, std::memory_order_acq_rel))
+        triggerAsyncUpdate();
+}
+
+bool RateLimitedCallbackGroup::callPendingCallbacks()
+{
+    frameRequested.store (false, std::memory_order_release);
+
+    auto calledSomething = false;
+
+    // by index as a callback may delete another callback
+    for (int i = 0; i < callbacks.size(); ++i)
+    {
+        auto* callback = callbacks.getUnchecked (i);
+
+        if (callback->updatePending.exchange (false, std::memory_order_acq_rel))
+        {
+            calledSomething = true;
+            callback->function();
+        }
+    }
+
+    return calledSomething;
+}
+
+void RateLimitedCallbackGroup::handleAsyncUpdate()
+{
+    // if the clock is idle run the first frame straight away, otherwise wait for the next tick
+    if (! isTimerRunning())
     {
-        function();
-        updatePending = false;
+        callPendingCallbacks();
+        startTimerHz (framesPerSecond);
     }
 }
 
+void RateLimitedCallbackGroup::timerCallback()
+{
+    if (! callPendingCallbacks())
+        stopTimer();
+}
+
 void centreComponentsVertically (std::vector<Component*> components, const Rectangle<int>& withInArea)
 {
     if (components.empty())
@@ -245,4 +615,97 @@ bool isValidWindowsPathLength (const File& file)
     return true;
 }
 
+class LightweightThreadTests : public UnitTest
+{
+public:
+    LightweightThreadTests() : UnitTest ("LightweightThread") {}
+
+    void runTest() override
+    {
+        beginTest ("Name, affinity and stack size");
+        {
+            LightweightThread::Options options;
+            options.name = "jcf test thread";
+            options.affinityMask = 1;
+            options.stackSize = 512 * 1024;
+
+            Observed observed;
+            LightweightThread thread ([&observed] (Thread*) { observed.capture(); }, options);
+            expect (thread.getOptionsResult().wasOk(), thread.getOptionsResult().getErrorMessage());
+            expect (observed.done.wait (5000));
+
+            expectEquals (observed.name, options.name);
+           #if JUCE_LINUX
+            expect (observed.onlyOnFirstCpu);
+            expectGreaterOrEqual (observed.stackSize, options.stackSize);
+           #endif
+        }
+
+       #if JUCE_LINUX
+        beginTest ("Realtime scheduling");
+        {
+            LightweightThread::Options options;
+            options.scheduling = LightweightThread::Options::Scheduling::fifo;
+            options.realtimePriority = 10;
+
+            Observed observed;
+            LightweightThread thread ([&observed] (Thread*) { observed.capture(); }, options);
+            expect (observed.done.wait (5000));
+
+            // needs CAP_SYS_NICE or an rtprio limit, without them the failure must be reported
+            if (thread.getOptionsResult().wasOk())
+            {
+                expectEquals (observed.policy, SCHED_FIFO);
+                expectEquals (observed.priority, options.realtimePriority);
+            }
+            else
+            {
+                logMessage ("realtime scheduling unavailable: " + thread.getOptionsResult().getErrorMessage());
+                expectNotEquals (observed.policy, SCHED_FIFO);
+            }
+        }
+       #endif
+    }
+
+private:
+    /** What the thread sees of itself, captured on the thread. */
+    struct Observed
+    {
+        void capture()
+        {
+            name = Thread::getCurrentThread()->getThreadName();
+
+           #if JUCE_LINUX
+            cpu_set_t cpus;
+            CPU_ZERO (&cpus);
+            pthread_getaffinity_np (pthread_self(), sizeof (cpus), &cpus);
+            onlyOnFirstCpu = CPU_COUNT (&cpus) == 1 && CPU_ISSET (0, &cpus);
+
+            pthread_attr_t attributes;
+
+            if (pthread_getattr_np (pthread_self(), &attributes) == 0)
+            {
+                pthread_attr_getstacksize (&attributes, &stackSize);
+                pthread_attr_destroy (&attributes);
+            }
+
+            sched_param param{};
+            pthread_getschedparam (pthread_self(), &policy, &param);
+            priority = param.sched_priority;
+           #endif
+
+            done.signal();
+        }
+
+        WaitableEvent done;
+        String name;
+        bool onlyOnFirstCpu{ false };
+        size_t stackSize{ 0 };
+        int policy{ 0 };
+        int priority{ 0 };
+    };
+};
+
+static LightweightThreadTests lightweight_thread_tests;
+
 } // namespace jcf
@@ -43,13 +43,77 @@ bool isValidWindowsPathLength (const juce::File& file);
 class LightweightThread : public juce::Thread
 {
 public:
+    struct Options
+    {
+        /** Realtime scheduling policies.  fifo and roundRobin are only supported on Linux. */
+        enum class Scheduling
+        {
+            normal,
+            fifo,
+            roundRobin
+        };
+
+        /** Shown in debuggers and profilers. */
+        juce::String name{ "lc lightweight thread" };
+        Priority priority{ Priority::normal };
+        Scheduling scheduling{ Scheduling::normal };
+        /** The SCHED_FIFO or SCHED_RR priority, 1 to 99 on Linux. */
+        int realtimePriority{ 1 };
+        /** A bit per CPU the thread may run on, 0 leaves it to the OS. */
+        juce::uint32 affinityMask{ 0 };
+        size_t stackSize{ osDefaultStackSize };
+        int threadExitTime{ 20000 };
+    };
+
     LightweightThread (std::function<void (Thread*)> func, int threadExitTime = 20000);
 
+    /**
+     * Starts the thread with the given options.  If scheduling or affinity options are set the
+     * constructor waits until the thread has applied them, so getOptionsResult() is valid
+     * straight away.
+     */
+    LightweightThread (std::function<void (Thread*)> func, const Options& options);
+
     ~LightweightThread();
 
     void run() override;
+
+    /**
+     * Returns a failure if the scheduling or affinity options could not be applied or didn't
+     * read back as requested, e.g. because the process lacks the rights for realtime scheduling.
+     */
+    juce::Result getOptionsResult() const;
+
+    /**
+     * Passes ownership of the thread to a background reaper rather than blocking until it
+     * finishes.  The thread is asked to exit straight away and is deleted on the reaper's
+     * thread once it has, after which onComplete, if set, is called on the message thread.
+     * Use this when closing a UI mustn't wait for a task.
+     */
+    static void detach (std::unique_ptr<LightweightThread> thread, std::function<void()> onComplete = {});
+
+    /** A deleter that detaches instead of blocking, calling onDetachedCompletion when done. */
+    struct Detacher
+    {
+        void operator() (LightweightThread* thread) const;
+    };
+
+    /** An owning pointer that hands the thread to the reaper when it's destroyed. */
+    using DetachingPtr = std::unique_ptr<LightweightThread, Detacher>;
+
     std::function<void (Thread*)> func;
     int threadExitTime;
+
+    /** Called on the message thread once a thread owned by a DetachingPtr has been reaped. */
+    std::function<void()> onDetachedCompletion;
+
+private:
+    /** Called on the new thread before func. */
+    juce::Result applyOptions();
+
+    Options options;
+    juce::Result optionsResult{ juce::Result::ok() };
+    juce::WaitableEvent optionsApplied;
 };
 
 /**
@@ -71,39 +135,283 @@ public:
     ~DelayedSharedResourcePointer()
     {
         auto& holder = getSharedObjectHolder();
-        const juce::SpinLock::ScopedLockType sl (holder.lock);
+        std::unique_ptr<SharedObjectType> released;
+        bool wasLastReference = false;
+        int keepAliveMilliseconds = 0;
+        int generation = 0;
 
-        if (--(holder.refCount) == 0)
-            holder.sharedInstance.reset();
+        {
+            const juce::SpinLock::ScopedLockType sl (holder.lock);
+
+            if (--(holder.refCount) == 0)
+            {
+                if (holder.keepAliveMilliseconds > 0 && holder.sharedInstance != nullptr
+                    && juce::MessageManager::getInstanceWithoutCreating() != nullptr)
+                {
+                    keepAliveMilliseconds = holder.keepAliveMilliseconds;
+                    generation = ++holder.evictionGeneration;
+                }
+                else
+                {
+                    released = releaseInstance (holder);
+                    wasLastReference = true;
+                }
+            }
+        }
+
+        if (keepAliveMilliseconds > 0)
+        {
+            registerShutdownEviction (holder);
+            juce::Timer::callAfterDelay (keepAliveMilliseconds, [generation] { evictIfIdle (generation); });
+        }
+
+        // a prewarm may still be constructing, it'll see nobody wants the object and throw it away
+        if (wasLastReference)
+            detachPrewarmThread (holder);
     }
 
-    /** Returns the shared object, creating it if it doesn't already exist. */
+    /**
+     * Returns the shared object, creating it if it doesn't already exist.  Once the object
+     * exists this is a single acquire load.  If it's being constructed, here or by
+     * prewarmAsync(), this blocks until it's ready rather than spinning.
+     */
     SharedObjectType& get() const
     {
         auto& holder = getSharedObjectHolder();
-        const juce::SpinLock::ScopedLockType sl (holder.lock);
 
-        if (holder.sharedInstance == nullptr)
-            holder.sharedInstance.reset (new SharedObjectType());
+        // our reference keeps the object alive, so once it's published we can use it without the lock
+        if (auto* instance = holder.instance.load (std::memory_order_acquire))
+            return *instance;
 
-        return *holder.sharedInstance;
+        return *createInstanceIfNeeded (holder);
+    }
+
+    /**
+     * Starts constructing the shared object on a background thread, e.g. when a plugin loads,
+     * so it's ready, or nearly ready, by the first get().  onReady is called on the message
+     * thread once the object exists, straight away if it already does.  The object must be
+     * safe to construct off the message thread.  Prewarming only helps while at least one
+     * DelayedSharedResourcePointer is kept alive to hold the object.
+     */
+    void prewarmAsync (std::function<void()> onReady = {})
+    {
+        auto& holder = getSharedObjectHolder();
+        bool alreadyExists;
+
+        {
+            const juce::SpinLock::ScopedLockType sl (holder.lock);
+            alreadyExists = holder.sharedInstance != nullptr;
+
+            if (! alreadyExists && onReady != nullptr)
+                holder.readyCallbacks.push_back (std::move (onReady));
+        }
+
+        if (alreadyExists)
+        {
+            if (onReady != nullptr)
+                juce::MessageManager::callAsync (std::move (onReady));
+
+            return;
+        }
+
+        const juce::ScopedLock tl (holder.threadLock);
+
+        if (holder.prewarmThread == nullptr)
+            holder.prewarmThread = std::make_unique<LightweightThread> ([&holder] (juce::Thread*) { prewarm (holder); });
     }
 
     /** Returns the number of SharedResourcePointers that are currently holding the shared object. */
     int getReferenceCount() const noexcept { return getSharedObjectHolder().refCount; }
 
+    /**
+     * Keeps the shared object alive for a while after the last DelayedSharedResourcePointer
+     * goes away.  If a new one is created within the period the object is reused, otherwise
+     * it's deleted on the message thread.  Useful where hosts repeatedly close and reopen
+     * plugin editors.  The default of zero deletes the object straight away.  An object that's
+     * still being kept alive when JUCE shuts down is deleted by DeletedAtShutdown::deleteAll().
+     */
+    static void setKeepAlivePeriod (int milliseconds)
+    {
+        auto& holder = getSharedObjectHolder();
+        const juce::SpinLock::ScopedLockType sl (holder.lock);
+        holder.keepAliveMilliseconds = juce::jmax (0, milliseconds);
+    }
+
+    /** Deletes the shared object now if it's only being kept alive by the keep alive period. */
+    static void releaseIdleInstance() { evictIfIdle (-1); }
+
+    struct Stats
+    {
+        /** Number of times the object was constructed. */
+        int numConstructed{ 0 };
+        /** Number of times an idle object was picked up again within the keep alive period. */
+        int numReused{ 0 };
+        /** Number of times an idle object was deleted at the end of the keep alive period. */
+        int numEvicted{ 0 };
+    };
+
+    static Stats getStats()
+    {
+        auto& holder = getSharedObjectHolder();
+        const juce::SpinLock::ScopedLockType sl (holder.lock);
+        return holder.stats;
+    }
+
 private:
+    /*
+     * The SpinLock only guards the bookkeeping and is never held for long.  Construction is
+     * serialised by constructionLock, so anyone waiting for it blocks rather than spins.
+     */
     struct SharedObjectHolder
     {
         juce::SpinLock lock;
         std::unique_ptr<SharedObjectType> sharedInstance;
-        int refCount;
+        std::atomic<SharedObjectType*> instance{ nullptr }; // published copy of sharedInstance for lock-free reads
+        int refCount{ 0 };
+        std::vector<std::function<void()>> readyCallbacks;
+        int keepAliveMilliseconds{ 0 };
+        int evictionGeneration{ 0 }; // bumped to cancel a scheduled eviction
+        bool shutdownEvictionRegistered{ false };
+        Stats stats;
+
+        juce::CriticalSection constructionLock;
+
+        juce::CriticalSection threadLock;
+        std::unique_ptr<LightweightThread> prewarmThread; // guarded by threadLock
     };
 
     static SharedObjectHolder& getSharedObjectHolder() noexcept
     {
-        static void* holder[(sizeof (SharedObjectHolder) + sizeof (void*) - 1) / sizeof (void*)] = { nullptr };
-        return *reinterpret_cast<SharedObjectHolder*> (holder);
+        // never deleted so it outlives any static DelayedSharedResourcePointers, the last of
+        // which leaves it empty
+        static auto* holder = new SharedObjectHolder();
+        return *holder;
+    }
+
+    /**
+     * Constructs the object if nobody else has, without holding the SpinLock.  If nobody
+     * holds a reference by the time it's built it's thrown away, and nullptr returned.
+     */
+    static SharedObjectType* createInstanceIfNeeded (SharedObjectHolder& holder)
+    {
+        const juce::ScopedLock cl (holder.constructionLock);
+
+        if (auto* instance = holder.instance.load (std::memory_order_acquire))
+            return instance;
+
+        auto newInstance = std::make_unique<SharedObjectType>();
+        auto* instance = newInstance.get();
+        std::vector<std::function<void()>> callbacks;
+
+        {
+            const juce::SpinLock::ScopedLockType sl (holder.lock);
+
+            // everyone let go while it was being built, only possible when prewarming
+            if (holder.refCount == 0)
+                instance = nullptr;
+            else
+            {
+                holder.sharedInstance = std::move (newInstance);
+                holder.instance.store (instance, std::memory_order_release);
+                ++holder.stats.numConstructed;
+                callbacks.swap (holder.readyCallbacks);
+            }
+        }
+
+        for (auto& callback : callbacks)
+            juce::MessageManager::callAsync (std::move (callback));
+
+        return instance; // newInstance, if still set, is deleted without the lock
+    }
+
+    /** Call with the lock held.  Returns the object, which must be deleted without the lock. */
+    static std::unique_ptr<SharedObjectType> releaseInstance (SharedObjectHolder& holder)
+    {
+        holder.instance.store (nullptr, std::memory_order_relaxed);
+        holder.readyCallbacks.clear();
+        return std::move (holder.sharedInstance);
+    }
+
+    /**
+     * Hands any prewarm thread to the reaper, so a slow construction that's still running
+     * doesn't block whoever let go last, often the message thread.  Call without the SpinLock.
+     */
+    static void detachPrewarmThread (SharedObjectHolder& holder)
+    {
+        std::unique_ptr<LightweightThread> thread;
+
+        {
+            const juce::ScopedLock tl (holder.threadLock);
+            thread = std::move (holder.prewarmThread);
+        }
+
+        LightweightThread::detach (std::move (thread));
+    }
+
+    /** Deletes the object if nobody has picked it up since the eviction was scheduled, any generation if -1. */
+    static void evictIfIdle (int generation)
+    {
+        auto& holder = getSharedObjectHolder();
+        std::unique_ptr<SharedObjectType> released;
+
+        {
+            const juce::SpinLock::ScopedLockType sl (holder.lock);
+
+            if (holder.refCount == 0 && holder.sharedInstance != nullptr && (generation == -1 || generation == holder.evictionGeneration))
+            {
+                released = releaseInstance (holder);
+                ++holder.stats.numEvicted;
+            }
+        }
+
+        if (released != nullptr)
+            detachPrewarmThread (holder);
+    }
+
+    /**
+     * Deletes an idle object when JUCE shuts down, as the eviction timer won't fire if we're
+     * inside the keep alive period, and the holder is never deleted.
+     */
+    struct ShutdownEviction : private juce::DeletedAtShutdown
+    {
+        ~ShutdownEviction() override
+        {
+            auto& holder = getSharedObjectHolder();
+
+            {
+                const juce::SpinLock::ScopedLockType sl (holder.lock);
+                holder.shutdownEvictionRegistered = false;
+            }
+
+            evictIfIdle (-1);
+        }
+    };
+
+    /** Call without the SpinLock. */
+    static void registerShutdownEviction (SharedObjectHolder& holder)
+    {
+        {
+            const juce::SpinLock::ScopedLockType sl (holder.lock);
+
+            if (std::exchange (holder.shutdownEvictionRegistered, true))
+                return;
+        }
+
+        new ShutdownEviction();
+    }
+
+    /** Runs on the prewarm thread. */
+    static void prewarm (SharedObjectHolder& holder)
+    {
+        {
+            const juce::SpinLock::ScopedLockType sl (holder.lock);
+
+            // everyone let go before we got started
+            if (holder.refCount == 0)
+                return;
+        }
+
+        createInstanceIfNeeded (holder);
     }
 
     void initialise()
@@ -111,7 +419,14 @@ private:
         auto& holder = getSharedObjectHolder();
         const juce::SpinLock::ScopedLockType sl (holder.lock);
 
-        ++holder.refCount;
+        if (holder.refCount++ == 0)
+        {
+            // cancels any scheduled eviction
+            ++holder.evictionGeneration;
+
+            if (holder.sharedInstance != nullptr)
+                ++holder.stats.numReused;
+        }
     }
 
     // There's no need to assign to a SharedResourcePointer because every
@@ -121,6 +436,72 @@ private:
     JUCE_LEAK_DETECTOR (DelayedSharedResourcePointer)
 };
 
+/**
+ * A task running on a LightweightThreadPool.  Like LightweightThread it owns the task and
+ * blocks on destruction until it's complete, but it runs on one of the pool's threads rather
+ * than paying for a new thread.  If the task hasn't started by the time it's destroyed it's
+ * simply removed from the queue.
+ */
+class LightweightTask
+{
+public:
+    ~LightweightTask();
+
+    /** Waits for the task to complete.  Returns false if it timed out. */
+    bool join (int timeOutMilliseconds = -1);
+
+    /** Returns true if the task has finished running or was never started. */
+    bool isFinished() const;
+
+    /** Asks the task to stop.  The function should check ThreadPoolJob::shouldExit(). */
+    void signalTaskShouldExit();
+
+private:
+    friend class LightweightThreadPool;
+
+    class Job;
+
+    LightweightTask (juce::ThreadPool& pool, std::function<void (juce::ThreadPoolJob*)> func, int taskExitTime);
+
+    juce::ThreadPool& pool;
+    std::unique_ptr<Job> job;
+    int taskExitTime;
+
+    JUCE_DECLARE_NON_COPYABLE (LightweightTask)
+};
+
+/**
+ * A fixed-size pool of threads for running short tasks without creating a thread per task.
+ * Use with DelayedSharedResourcePointer to share a single pool across the application.  The
+ * pool must outlive any tasks submitted to it.
+ */
+class LightweightThreadPool
+{
+public:
+    explicit LightweightThreadPool (int numberOfThreads = juce::SystemStats::getNumCpus());
+
+    ~LightweightThreadPool();
+
+    /**
+     * Queues the function to run on one of the pool's threads.  Destroying the returned task
+     * signals it to exit and blocks until it's complete, waiting at most taskExitTime.
+     */
+    std::unique_ptr<LightweightTask> submit (std::function<void (juce::ThreadPoolJob*)> func, int taskExitTime = 20000);
+
+    /**
+     * Queues a function with nobody waiting on it.  Functions still queued when the pool is
+     * destroyed are dropped without being called.
+     */
+    void post (std::function<void()> func);
+
+    int getNumThreads() const;
+
+private:
+    juce::ThreadPool pool;
+
+    JUCE_DECLARE_NON_COPYABLE (LightweightThreadPool)
+};
+
 class ApplicationActivtyMonitor : public juce::Timer, juce::MouseListener
 {
 public:
@@ -303,30 +684,174 @@ private:
     std::unique_ptr<juce::Drawable> d;
 };
 
+class RateLimitedCallbackGroup;
+
 /**
  * When triggered calls a function no faster than the rate limit.  Calls it immediately if the
  * rate hasn't been exceeded.  Guarantees that the function is called at least once after each
  * trigger.  Can be triggered from any thread, the callback occurs on the message thread.
+ *
+ * trigger() is a lock-free test-and-set of a pending flag and only posts a message when the
+ * flag goes from clear to set, so it's cheap to call from a worker or realtime thread in a
+ * tight loop.  At most one message is posted per rate limit window however often it's called.
  */
 class RateLimitedCallback : juce::Timer, juce::AsyncUpdater
 {
 public:
     RateLimitedCallback (std::function<void()> function, int rateLimitMilliSeconds);
 
+    /**
+     * Creates a callback driven by the group's frame clock rather than its own timer.  The
+     * function is called on the next frame after a trigger.  The rate limit settings are
+     * ignored; the group's frame rate applies.  The group must outlive the callback.
+     */
+    RateLimitedCallback (std::function<void()> function, RateLimitedCallbackGroup& group);
+
     ~RateLimitedCallback();
 
     void trigger();
 
     void setRateLimit (int milliseconds);
 
+    /**
+     * Switches to adaptive rate limiting.  The execution time of the function is measured and
+     * the interval is widened so that the function uses no more than targetUtilisation (0 to 1)
+     * of the message thread's time.  When the function becomes cheap again the interval narrows
+     * back towards the rate limit, which remains the minimum interval.
+     */
+    void setAdaptiveRateLimit (float targetUtilisation, int maximumMilliSeconds = 1000);
+
+    /** Returns to the fixed rate limit. */
+    void disableAdaptiveRateLimit();
+
+    /** Returns the interval currently in use, which may be wider than the rate limit in adaptive mode. */
+    int getCurrentRateLimit() const;
+
 private:
     void handleAsyncUpdate() override;
 
     void timerCallback() override;
 
+    /** Calls the function, measuring its cost, and starts the rate limiting timer. */
+    void callFunctionAndStartTimer();
+
     std::function<void()> function;
     int rateLimitMilliSeconds;
-    bool updatePending{ false };
+
+    float targetUtilisation{ 0.0f }; // zero when adaptive mode is off
+    int maximumRateLimitMilliSeconds{ 1000 };
+    double averageCostMilliSeconds{ 0.0 };
+
+    /** Set by trigger(), cleared on the message thread just before the function is called. */
+    std::atomic<bool> updatePending{ false };
+
+    RateLimitedCallbackGroup* group{ nullptr };
+
+    friend class RateLimitedCallbackGroup;
+};
+
+/**
+ * A frame clock shared by many RateLimitedCallbacks.  Instead of each callback running its own
+ * timer and firing at an uncorrelated moment, the group collects the pending callbacks and
+ * calls them all in one tick at a fixed frame rate, so components update in one batch per frame.
+ *
+ * The timer only runs while callbacks are being triggered.  Create and destroy the group and its
+ * callbacks on the message thread; the callbacks can be triggered from any thread.
+ */
+class RateLimitedCallbackGroup : juce::Timer, juce::AsyncUpdater
+{
+public:
+    explicit RateLimitedCallbackGroup (int framesPerSecond = 60);
+
+    ~RateLimitedCallbackGroup();
+
+    void setFrameRate (int framesPerSecond);
+
+private:
+    friend class RateLimitedCallback;
+
+    void addCallback (RateLimitedCallback* callback);
+    void removeCallback (RateLimitedCallback* callback);
+
+    /** Called from any thread when one of the callbacks goes from idle to pending. */
+    void requestFrame();
+
+    /** Calls all the pending callbacks.  Returns false if there was nothing to do. */
+    bool callPendingCallbacks();
+
+    void handleAsyncUpdate() override;
+
+    void timerCallback() override;
+
+    juce::Array<RateLimitedCallback*> callbacks;
+    std::atomic<bool> frameRequested{ false };
+    int framesPerSecond;
+
+    JUCE_DECLARE_NON_COPYABLE (RateLimitedCallbackGroup)
+};
+
+/**
+ * A RateLimitedCallback that carries a payload.  The producer calls set() from any thread and
+ * the callback receives the most recent value on the message thread, at most once per rate
+ * limit interval.  Intermediate values are dropped, which is what you want for level meters
+ * and progress bars.
+ *
+ * The latest value is held in a lock-free triple buffer so set() never blocks and is safe on
+ * a realtime thread as long as copying a ValueType doesn't allocate.  Only one thread should
+ * call set() at any one time.  ValueType must be default constructible and copy assignable.
+ */
+template <typename ValueType>
+class RateLimitedValue
+{
+public:
+    RateLimitedValue (std::function<void (const ValueType&)> callback, int rateLimitMilliSeconds)
+        : callback (std::move (callback)), rateLimitedCallback ([this] { deliver(); }, rateLimitMilliSeconds)
+    {
+    }
+
+    RateLimitedValue (std::function<void (const ValueType&)> callback, RateLimitedCallbackGroup& group)
+        : callback (std::move (callback)), rateLimitedCallback ([this] { deliver(); }, group)
+    {
+    }
+
+    void set (const ValueType& newValue)
+    {
+        slots[backIndex] = newValue;
+
+        // publish our slot as the latest and take whichever slot was the latest to write into next
+        auto previous = latest.exchange (backIndex | newDataFlag, std::memory_order_acq_rel);
+        backIndex = previous & indexMask;
+
+        rateLimitedCallback.trigger();
+    }
+
+    void setRateLimit (int milliseconds) { rateLimitedCallback.setRateLimit (milliseconds); }
+
+private:
+    void deliver()
+    {
+        if ((latest.load (std::memory_order_acquire) & newDataFlag) == 0)
+            return;
+
+        auto previous = latest.exchange (frontIndex, std::memory_order_acq_rel);
+        frontIndex = previous & indexMask;
+
+        callback (slots[frontIndex]);
+    }
+
+    static constexpr int indexMask = 3;
+    static constexpr int newDataFlag = 4;
+
+    std::function<void (const ValueType&)> callback;
+
+    ValueType slots[3];
+    std::atomic<int> latest{ 1 }; // index of the most recently published slot, plus newDataFlag
+    int backIndex{ 0 }; // only touched by the producer
+    int frontIndex{ 2 }; // only touched on the message thread
+
+    RateLimitedCallback rateLimitedCallback;
+
+    JUCE_DECLARE_NON_COPYABLE (RateLimitedValue)
 };
 
 /**
@@ -0,0 +1,194 @@
+#pragma once
+#include <juce_core/juce_core.h>
+#include "other_utils.h"
+
+// <span> warns when included before C++20 on some compilers, so check the library supports it first
+#if __has_include(<version>)
+#include <version>
+#endif
+
+#if __cpp_lib_span >= 202002L
+#include <span>
+#endif
+
+namespace jcf
+{
+
+/**
+ * Data parallel loops over a LightweightThreadPool.
+ *
+ * The items are split into fixed chunks of grainSize items.  The calling thread and up to one
+ * task per pool thread take chunks from a shared counter until none are left, so a slow chunk
+ * doesn't hold up the others.  When there is only one chunk, or the pool only has one thread,
+ * the loop runs serially on the calling thread with no tasks submitted.  Pick a grainSize
+ * large enough that a chunk costs noticeably more than submitting a task, a few microseconds.
+ *
+ * The chunk boundaries depend only on the number of items and the grainSize, never on the
+ * number of threads, and parallelReduce combines the partial results in chunk order, so the
+ * result is the same from run to run even for floating point.
+ *
+ * These functions block until all the work is complete.  It's safe to call them from one of
+ * the pool's own threads.
+ */
+namespace parallel
+{
+constexpr int defaultGrainSize = 256;
+
+template <typename ChunkFunction>
+void runChunks (LightweightThreadPool& pool, int numChunks, ChunkFunction&& chunkFunction)
+{
+    if (numChunks <= 1 || pool.getNumThreads() <= 1)
+    {
+        for (int chunk = 0; chunk < numChunks; ++chunk)
+            chunkFunction (chunk);
+
+        return;
+    }
+
+    std::atomic<int> nextChunk{ 0 };
+
+    auto worker = [&]
+    {
+        for (int chunk; (chunk = nextChunk.fetch_add (1, std::memory_order_relaxed)) < numChunks;)
+            chunkFunction (chunk);
+    };
+
+    auto numTasks = juce::jmin (pool.getNumThreads(), numChunks - 1);
+    std::vector<std::unique_ptr<LightweightTask>> tasks;
+    tasks.reserve ((size_t) numTasks);
+
+    for (int i = 0; i < numTasks; ++i)
+        tasks.push_back (pool.submit ([&worker] (juce::ThreadPoolJob*) { worker(); }));
+
+    worker();
+
+    // tasks that never got a thread are dequeued, running ones finish their last chunk
+    tasks.clear();
+}
+
+inline int getNumChunks (int numItems, int grainSize)
+{
+    jassert (grainSize > 0);
+    return (numItems + grainSize - 1) / grainSize;
+}
+} // namespace parallel
+
+/** Calls function (index) for every index from 0 to numItems - 1. */
+template <typename Function>
+void parallelFor (LightweightThreadPool& pool, int numItems, Function&& function, int grainSize = parallel::defaultGrainSize)
+{
+    parallel::runChunks (pool,
+                         parallel::getNumChunks (numItems, grainSize),
+                         [&] (int chunk)
+                         {
+                             auto end = juce::jmin (numItems, (chunk + 1) * grainSize);
+
+                             for (int i = chunk * grainSize; i < end; ++i)
+                                 function (i);
+                         });
+}
+
+/** Calls function (item) for every item in the range. */
+template <typename ElementType, typename Function>
+void parallelFor (LightweightThreadPool& pool, ElementType* items, int numItems, Function&& function, int grainSize = parallel::defaultGrainSize)
+{
+    parallelFor (pool, numItems, [&] (int i) { function (items[i]); }, grainSize);
+}
+
+/** Calls function (item) for every item in the array. */
+template <typename ElementType, typename TypeOfCriticalSectionToUse, int minimumAllocatedSize, typename Function>
+void parallelFor (LightweightThreadPool& pool,
+                  juce::Array<ElementType, TypeOfCriticalSectionToUse, minimumAllocatedSize>& array,
+                  Function&& function,
+                  int grainSize = parallel::defaultGrainSize)
+{
+    parallelFor (pool, array.getRawDataPointer(), array.size(), function, grainSize);
+}
+
+#if __cpp_lib_span >= 202002L
+/** Calls function (item) for every item in the span. */
+template <typename ElementType, size_t extent, typename Function>
+void parallelFor (LightweightThreadPool& pool, std::span<ElementType, extent> items, Function&& function, int grainSize = parallel::defaultGrainSize)
+{
+    parallelFor (pool, items.data(), (int) items.size(), function, grainSize);
+}
+#endif
+
+/**
+ * Folds every index from 0 to numItems - 1 into a result.  Each chunk starts from identity and
+ * folds its indices in order with accumulate (ResultType, index), then the chunk results are
+ * folded in chunk order with combine (ResultType, ResultType).
+ */
+template <typename ResultType, typename AccumulateFunction, typename CombineFunction>
+ResultType parallelReduce (LightweightThreadPool& pool,
+                           int numItems,
+                           ResultType identity,
+                           AccumulateFunction&& accumulate,
+                           CombineFunction&& combine,
+                           int grainSize = parallel::defaultGrainSize)
+{
+    auto numChunks = parallel::getNumChunks (numItems, grainSize);
+    std::vector<ResultType> partialResults ((size_t) numChunks, identity);
+
+    parallel::runChunks (pool,
+                         numChunks,
+                         [&] (int chunk)
+                         {
+                             auto end = juce::jmin (numItems, (chunk + 1) * grainSize);
+                             auto partial = identity;
+
+                             for (int i = chunk * grainSize; i < end; ++i)
+                                 partial = accumulate (std::move (partial), i);
+
+                             partialResults[(size_t) chunk] = std::move (partial);
+                         });
+
+    auto result = std::move (identity);
+
+    for (auto& partial : partialResults)
+        result = combine (std::move (result), std::move (partial));
+
+    return result;
+}
+
+/** Folds every item in the range, see above. accumulate is called as accumulate (ResultType, item). */
+template <typename ElementType, typename ResultType, typename AccumulateFunction, typename CombineFunction>
+ResultType parallelReduce (LightweightThreadPool& pool,
+                           ElementType* items,
+                           int numItems,
+                           ResultType identity,
+                           AccumulateFunction&& accumulate,
+                           CombineFunction&& combine,
+                           int grainSize = parallel::defaultGrainSize)
+{
+    return parallelReduce (
+        pool, numItems, std::move (identity), [&] (ResultType r, int i) { return accumulate (std::move (r), items[i]); }, combine, grainSize);
+}
+
+/** Folds every item in the array, see above. accumulate is called as accumulate (ResultType, item). */
+template <typename ElementType, typename TypeOfCriticalSectionToUse, int minimumAllocatedSize, typename ResultType, typename AccumulateFunction, typename CombineFunction>
+ResultType parallelReduce (LightweightThreadPool& pool,
+                           const juce::Array<ElementType, TypeOfCriticalSectionToUse, minimumAllocatedSize>& array,
+                           ResultType identity,
+                           AccumulateFunction&& accumulate,
+                           CombineFunction&& combine,
+                           int grainSize = parallel::defaultGrainSize)
+{
+    return parallelReduce (pool, array.begin(), array.size(), std::move (identity), accumulate, combine, grainSize);
+}
+
+#if __cpp_lib_span >= 202002L
+/** Folds every item in the span, see above. accumulate is called as accumulate (ResultType, item). */
+template <typename ElementType, size_t extent, typename ResultType, typename AccumulateFunction, typename CombineFunction>
+ResultType parallelReduce (LightweightThreadPool& pool,
+                           std::span<ElementType, extent> items,
+                           ResultType identity,
+                           AccumulateFunction&& accumulate,
+                           CombineFunction&& combine,
+                           int grainSize = parallel::defaultGrainSize)
+{
+    return parallelReduce (pool, items.data(), (int) items.size(), std::move (identity), accumulate, combine, grainSize);
+}
+#endif
+
+} // namespace jcf
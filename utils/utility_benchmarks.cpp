@@ -0,0 +1,182 @@
+#include "utility_benchmarks.h"
+namespace jcf
+{
+
+namespace
+{
+    struct BenchmarkSharedResource
+    {
+        std::atomic<int> value{ 1 };
+    };
+} // namespace
+
+var UtilityBenchmarks::run (const Settings& settings)
+{
+    JUCE_ASSERT_MESSAGE_MANAGER_IS_LOCKED
+
+    auto* root = new DynamicObject();
+    root->setProperty ("benchmark", "Utilities");
+    root->setProperty ("time", Time::getCurrentTime().toISO8601 (true));
+    root->setProperty ("numCpus", SystemStats::getNumCpus());
+    root->setProperty ("rateLimitedCallbackTriggers", measureRateLimitedCallbackTriggers (settings));
+    root->setProperty ("parallelForCrossover", measureParallelForCrossover (settings));
+    root->setProperty ("sharedResourceContention", measureSharedResourceContention (settings));
+    return root;
+}
+
+Result UtilityBenchmarks::runAndWriteJson (const File& jsonFile, const Settings& settings)
+{
+    return benchmark::writeJson (run (settings), jsonFile);
+}
+
+template <typename Function>
+double UtilityBenchmarks::measureCallsPerSecond (int numThreads, int durationMilliseconds, Function&& function)
+{
+    std::atomic<bool> started{ false }, finished{ false };
+    std::atomic<int64> numCalls{ 0 };
+    std::vector<std::unique_ptr<LightweightThread>> threads;
+
+    for (int t = 0; t < numThreads; ++t)
+    {
+        threads.push_back (std::make_unique<LightweightThread> (
+            [&, t] (Thread*)
+            {
+                while (! started.load())
+                    Thread::yield();
+
+                int64 calls = 0;
+
+                for (; ! finished.load (std::memory_order_relaxed); ++calls)
+                    function (t);
+
+                numCalls += calls;
+            }));
+    }
+
+    auto start = Time::getHighResolutionTicks();
+    started = true;
+    Thread::sleep (durationMilliseconds);
+    finished = true;
+    threads.clear();
+
+    return (double) numCalls.load() / (benchmark::microsecondsSince (start) * 1.0e-6);
+}
+
+var UtilityBenchmarks::measureRateLimitedCallbackTriggers (const Settings& settings)
+{
+    int numCallbacks = 0;
+    RateLimitedCallback callback ([&numCallbacks] { ++numCallbacks; }, 50);
+
+    // the message loop isn't running, so after the first trigger every one is the cheap no-post path
+    Array<var> results;
+
+    for (int numThreads = 1; numThreads <= settings.maxThreads; numThreads *= 2)
+    {
+        auto* result = new DynamicObject();
+        result->setProperty ("numThreads", numThreads);
+        result->setProperty ("triggersPerSecond",
+                             measureCallsPerSecond (numThreads, settings.durationMilliseconds, [&callback] (int) { callback.trigger(); }));
+        results.add (result);
+    }
+
+    return results;
+}
+
+var UtilityBenchmarks::measureParallelForCrossover (const Settings& settings)
+{
+    LightweightThreadPool pool (settings.maxThreads);
+    Array<var> results;
+
+    // a few cheap floating point operations per item, like a typical bulk conversion
+    auto work = [] (float x) { return std::sqrt (x * x + 1.0f) * 0.5f; };
+
+    for (auto numItems : settings.parallelForSizes)
+    {
+        std::vector<float> input ((size_t) numItems), output ((size_t) numItems);
+
+        for (size_t i = 0; i < input.size(); ++i)
+            input[i] = (float) i;
+
+        // repeat small sizes so each timing covers roughly the same amount of work
+        auto numRepeats = jmax (1, 1048576 / numItems);
+
+        auto timePerRepeat = [numRepeats] (auto&& loop)
+        {
+            loop(); // warm up
+
+            auto start = Time::getHighResolutionTicks();
+
+            for (int r = 0; r < numRepeats; ++r)
+                loop();
+
+            return benchmark::microsecondsSince (start) / numRepeats;
+        };
+
+        auto serial = timePerRepeat ([&]
+                                     {
+                                         for (int i = 0; i < numItems; ++i)
+                                             output[(size_t) i] = work (input[(size_t) i]);
+                                     });
+
+        auto parallel = timePerRepeat ([&] { parallelFor (pool, numItems, [&] (int i) { output[(size_t) i] = work (input[(size_t) i]); }); });
+
+        double sum = 0;
+        auto serialReduce = timePerRepeat ([&]
+                                           {
+                                               sum = 0;
+
+                                               for (int i = 0; i < numItems; ++i)
+                                                   sum += work (input[(size_t) i]);
+                                           });
+
+        auto parallelReduceTime = timePerRepeat (
+            [&]
+            {
+                sum = parallelReduce (
+                    pool, numItems, 0.0, [&] (double r, int i) { return r + work (input[(size_t) i]); }, [] (double a, double b) { return a + b; });
+            });
+
+        auto* result = new DynamicObject();
+        result->setProperty ("numItems", numItems);
+        result->setProperty ("serialFor", serial);
+        result->setProperty ("parallelFor", parallel);
+        result->setProperty ("parallelForSpeedup", serial / parallel);
+        result->setProperty ("serialReduce", serialReduce);
+        result->setProperty ("parallelReduce", parallelReduceTime);
+        result->setProperty ("parallelReduceSpeedup", serialReduce / parallelReduceTime);
+        result->setProperty ("checksum", sum); // so the work can't be optimised away
+        results.add (result);
+    }
+
+    auto* root = new DynamicObject();
+    root->setProperty ("numThreads", pool.getNumThreads());
+    root->setProperty ("grainSize", parallel::defaultGrainSize);
+    root->setProperty ("sizes", results);
+    return root;
+}
+
+var UtilityBenchmarks::measureSharedResourceContention (const Settings& settings)
+{
+    // one pointer per thread, like components that each hold one, all sharing the object
+    std::vector<DelayedSharedResourcePointer<BenchmarkSharedResource>> pointers ((size_t) settings.maxThreads);
+    pointers.front().get(); // constructed up front, so only the lock-free path is timed
+
+    Array<var> results;
+
+    for (int numThreads = 1; numThreads <= settings.maxThreads; numThreads *= 2)
+    {
+        auto callsPerSecond = measureCallsPerSecond (numThreads,
+                                                     settings.durationMilliseconds,
+                                                     [&pointers] (int t) { pointers[(size_t) t].get().value.load (std::memory_order_relaxed); });
+
+        auto* result = new DynamicObject();
+        result->setProperty ("numThreads", numThreads);
+        result->setProperty ("getsPerSecond", callsPerSecond);
+        result->setProperty ("nanosecondsPerGet", numThreads * 1.0e9 / callsPerSecond);
+        results.add (result);
+    }
+
+    return results;
+}
+
+} // namespace jcf
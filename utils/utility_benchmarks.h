@@ -0,0 +1,53 @@
+#pragma once
+#include <juce_core/juce_core.h>
+#include "other_utils.h"
+#include "parallel_for.h"
+#include "benchmark_utils.h"
+
+namespace jcf
+{
+
+/**
+ * Benchmarks for the threading utilities in the module, so changes to them can be compared.
+ * Enable with JCF_BENCHMARKS=1 and call run() from a small app or test runner.  Results are
+ * returned as an object suitable for JSON::toString(), times in microseconds unless the name
+ * says otherwise.
+ *
+ * Must be called on the message thread.  The message loop isn't run while it's working.
+ */
+class UtilityBenchmarks
+{
+public:
+    struct Settings
+    {
+        /** Each multi-threaded case is run with 1, 2, 4 ... up to this many threads. */
+        int maxThreads{ 8 };
+        int durationMilliseconds{ 250 };
+
+        /** The parallelFor crossover is measured at each of these numbers of items. */
+        juce::Array<int> parallelForSizes{ 64, 256, 1024, 4096, 16384, 65536, 262144, 1048576 };
+    };
+
+    static juce::var run (const Settings& settings);
+
+    static juce::Result runAndWriteJson (const juce::File& jsonFile, const Settings& settings);
+
+    /** RateLimitedCallback::trigger() calls per second with several threads triggering at once. */
+    static juce::var measureRateLimitedCallbackTriggers (const Settings& settings);
+
+    /**
+     * Times a serial loop, parallelFor and parallelReduce over the same work at each size,
+     * with maxThreads pool threads, to show where going parallel starts to pay off.
+     */
+    static juce::var measureParallelForCrossover (const Settings& settings);
+
+    /** DelayedSharedResourcePointer::get() calls per second with several threads reading the object at once. */
+    static juce::var measureSharedResourceContention (const Settings& settings);
+
+private:
+    /** Runs function (threadIndex) repeatedly on numThreads threads, returning the total calls per second. */
+    template <typename Function>
+    static double measureCallsPerSecond (int numThreads, int durationMilliseconds, Function&& function);
+};
+
+} // namespace jcf